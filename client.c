@@ -0,0 +1,104 @@
+/* dlauncher-client: send a command to the dlauncher daemon, see control.h */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "control.h"
+#include "exec.h"
+
+/* how long a cold open waits for the daemon to come up */
+#define START_TIMEOUT_MS 5000
+#define START_STEP_MS      10
+
+static void
+usage(void) {
+    fputs("usage: dlauncher-client [open | open-text text | open-plugin name [text]\n"
+          "                         | reload | stats | quit]\n", stderr);
+    exit(EXIT_FAILURE);
+}
+
+/* run "dlauncher start" from the directory of this program */
+static void
+start_daemon(const char *self) {
+    char *cmd[] = { "dlauncher", "start", NULL };
+    char *path = NULL;
+    const char *slash = strrchr(self, '/');
+
+    if (slash && asprintf(&path, "%.*s/dlauncher", (int)(slash - self), self) >= 0)
+        cmd[0] = path;
+
+    pid_t pid = fork_and_exec(cmd, -1, -1, STDERR_FILENO);
+    if (pid > 0) waitpid(pid, NULL, 0);
+    free(path);
+}
+
+int
+main(int argc, char *argv[]) {
+    char line[CONTROL_LINE_MAX];
+    size_t len = 0;
+    int i, fd;
+
+    if (argc < 2) {
+        strcpy(line, "open");
+        len = 4;
+    }
+    for (i = 1; i < argc; ++ i) {
+        size_t n = strlen(argv[i]);
+        if (len + n + 2 > sizeof(line)) usage();
+        if (i > 1) line[len ++] = ' ';
+        memcpy(line + len, argv[i], n);
+        len += n;
+    }
+    line[len ++] = '\n';
+
+    fd = control_connect();
+    if (fd < 0 && strncmp(line, "open", 4) == 0) {
+        /* cold open, start the daemon and wait for its socket */
+        struct timespec step = { 0, START_STEP_MS * 1000000L };
+        start_daemon(argv[0]);
+        for (i = 0; fd < 0 && i < START_TIMEOUT_MS / START_STEP_MS; ++ i) {
+            nanosleep(&step, NULL);
+            fd = control_connect();
+        }
+    }
+    if (fd < 0) {
+        fprintf(stderr, "dlauncher is not running\n");
+        return EXIT_FAILURE;
+    }
+
+    ssize_t w = write(fd, line, len);
+    if (w < 0 || (size_t)w != len) {
+        perror("write");
+        return EXIT_FAILURE;
+    }
+    shutdown(fd, SHUT_WR);
+
+    /* print the reply, the status is in its last line */
+    char buf[BUFSIZ], last[BUFSIZ];
+    size_t last_len = 0;
+    int eol = 1;
+    ssize_t r;
+    while ((r = read(fd, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, r, stdout);
+        for (i = 0; i < r; ++ i) {
+            if (buf[i] == '\n') {
+                eol = 1;
+                continue;
+            }
+            if (eol) last_len = 0;
+            eol = 0;
+            if (last_len + 1 < sizeof(last)) last[last_len ++] = buf[i];
+        }
+    }
+    last[last_len] = 0;
+    close(fd);
+
+    return strncmp(last, "ok", 2) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
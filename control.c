@@ -0,0 +1,105 @@
+#define _GNU_SOURCE
+
+#include "control.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* create the fallback directory, or check that an existing one is ours
+ * and private, since anyone can create it first in /tmp */
+static int
+_private_dir(const char *dir) {
+    struct stat st;
+
+    if (mkdir(dir, 0700) && errno != EEXIST) return -1;
+    if (lstat(dir, &st)) return -1;
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077)) {
+        fprintf(stderr, "%s is not a private directory of this user\n", dir);
+        return -1;
+    }
+    return 0;
+}
+
+int
+control_path(char *buf, size_t size) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    char tmp[64];
+    int r;
+
+    if (!dir || !*dir) {
+        snprintf(tmp, sizeof(tmp), "/tmp/dlauncher-%d", (int)getuid());
+        if (_private_dir(tmp)) return -1;
+        dir = tmp;
+    }
+    r = snprintf(buf, size, "%s/dlauncher.sock", dir);
+    return (r < 0 || (size_t)r >= size) ? -1 : 0;
+}
+
+static int
+_address(struct sockaddr_un *sa) {
+    memset(sa, 0, sizeof(struct sockaddr_un));
+    sa->sun_family = AF_UNIX;
+    return control_path(sa->sun_path, sizeof(sa->sun_path));
+}
+
+int
+control_connect(void) {
+    struct sockaddr_un sa;
+    int fd;
+
+    if (_address(&sa)) return -1;
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* the socket is created with no access for others from the start */
+static int
+_bind(int fd, struct sockaddr_un *sa) {
+    mode_t mask = umask(077);
+    int r = bind(fd, (struct sockaddr *)sa, sizeof(struct sockaddr_un));
+    umask(mask);
+    return r;
+}
+
+int
+control_listen(void) {
+    struct sockaddr_un sa;
+    int fd;
+
+    if (_address(&sa)) return -1;
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (_bind(fd, &sa)) {
+        int c;
+        if (errno != EADDRINUSE) goto failed;
+        /* left by a daemon that did not exit cleanly? */
+        if ((c = control_connect()) >= 0) {
+            close(c);
+            errno = EADDRINUSE;
+            goto failed;
+        }
+        unlink(sa.sun_path);
+        if (_bind(fd, &sa)) goto failed;
+    }
+    if (listen(fd, 8)) goto failed;
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+
+  failed:
+    close(fd);
+    return -1;
+}
@@ -0,0 +1,31 @@
+#ifndef __DLAUNCHER_CONTROL_H__
+#define __DLAUNCHER_CONTROL_H__
+
+#include <stddef.h>
+
+/* per-user control socket of the daemon
+ *
+ * A client connects, sends one command line and reads the reply until
+ * the daemon closes the connection. The reply ends with a line "ok" or
+ * "error <reason>". Commands:
+ *
+ *   open                   show the window
+ *   open-text <text>       show the window with the input set to <text>
+ *   open-plugin <name> [<text>]
+ *                          show the window with the plugin selected
+ *   reload                 restart the daemon in place
+ *   stats                  print the latency stats
+ *   quit                   exit the daemon
+ */
+
+#define CONTROL_LINE_MAX 4096
+
+/* $XDG_RUNTIME_DIR/dlauncher.sock, or else dlauncher.sock in the
+ * private directory /tmp/dlauncher-$UID, created if needed */
+int control_path(char *buf, size_t size);
+/* bind the socket, replacing a stale one; return -1 if another daemon
+ * is listening or on error */
+int control_listen(void);
+int control_connect(void);
+
+#endif
@@ -14,16 +14,38 @@
 #include <strings.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/Xutil.h>
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif
+#ifdef XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+#include "control.h"
 #include "draw.h"
 #include "hist.h"
+#include "match.h"
 #include "plugin.h"
+#include "query.h"
+#include "reactor.h"
+#include "stats.h"
+#include "trigram.h"
 #include "defaults.h"
 
 #define INTERSECT(x,y,w,h,r)  (MAX(0, MIN((x)+(w),(r).x_org+(r).width)  - MAX((x),(r).x_org)) \
@@ -31,7 +53,19 @@
 #define MIN(a,b)              ((a) < (b) ? (a) : (b))
 #define MAX(a,b)              ((a) > (b) ? (a) : (b))
 
+/* how long a keystroke waits for the plugin queries before drawing,
+ * plugins finishing later are drawn when they are done */
+#define QUERY_DEADLINE_MS 30
+
+/* retry period of the keyboard grab, and how long until giving up */
+#define GRAB_RETRY_MS   1
+#define GRAB_TIMEOUT_MS 1000
+
+/* width of the menu in headless mode */
+#define HEADLESS_WIDTH 1280
+
 static void calc_offsets(void);
+static unsigned int items(dl_plugin_t plugin);
 static void item_sel_next(void);
 static void complete_text(int update);
 static char *cistrstr(const char *s, const char *sub);
@@ -39,29 +73,128 @@ static void drawmenu(void);
 static void grabkeyboard(void);
 static void insert(const char *str, ssize_t n);
 static void keypress(XKeyEvent *ev);
+static void keysym_press(KeySym ksym, unsigned int state, char *buf, int len);
+static void open_item(dl_plugin_t plugin, int index, const char *input, int mode);
 static void update(int query);
+static void flush_query(void);
 static size_t nextrune(int inc);
 static void paste(void);
 static void run(void);
 static void usage(void);
 static void setup(void);
 static void calc_geo(void);
+static void geo_invalidate(void);
 static void show(void);
 static void hide(void);
-static void signal_show(int);
+static void signal_init(void);
+static void control_init(char *argv[]);
+
+static unsigned int query_generation = 0;
+/* the text was edited since the last query round */
+static int          query_dirty = 0;
 
-static int volatile to_show = 0;
 static int volatile showed = 0;
 
+/* SIGUSR1 shows the window and SIGUSR2 dumps the stats, both are
+ * delivered through signal_fd which is watched by the reactor */
+static int    signal_fd = -1;
+#ifndef __linux__
+static int    signal_pipe[2] = { -1, -1 };
+#endif
+static double signal_time;  /* arrival of the pending show signal */
+static stats_latency_s stats_show = { "show" };
+static stats_latency_s stats_key  = { "key" };     /* headless keys */
+static stats_latency_s stats_grab = { "grab" };    /* keyboard grab */
+
+/* listening control socket, see control.h */
+static int    control_fd = -1;
+static char **control_argv;     /* to restart in place */
+
 static void hist_show_prev(void);
 static void hist_show_next(void);
-static void hist_rebuild_file(void);
 static FILE       *hist_file;
 static char       *hist_file_path;
+/* history journal
+ *
+ * ~/.dlauncher_history is only ever appended to: every line is a record
+ * adding an entry, or moving it to the end when it is already there, so
+ * replaying the file through hist_add_line() restores the history. A
+ * record "@time" gives the time of the records after it, and "@time
+ * weight" also the frecency weight of the next record. Once
+ * the journal holds HIST_JOURNAL_SLACK records more than there are live
+ * entries, a thread writes the live entries to a temp file; the main
+ * thread then appends the records made meanwhile and renames the temp
+ * file over the journal.
+ *
+ * Other instances may share the journal, so it is written under flock().
+ * The records they appended since are replayed first, and a journal
+ * they replaced, which holds all our records, is loaded again.
+ */
+#define HIST_JOURNAL_SLACK HIST_SIZE
+static int             hist_journal_count;  /* records in the journal */
+static int             hist_compact_next;   /* count to try again at */
+static off_t           hist_journal_end;    /* bytes of it replayed */
+static int             hist_loading;        /* replaying, not recording */
+static char           *hist_journal_tmp;
+static int             hist_compacting;
+static pthread_t       hist_compactor;
+static pthread_mutex_t hist_compact_lock = PTHREAD_MUTEX_INITIALIZER;
+static int             hist_compact_done;   /* 1 written, -1 failed */
+static int             hist_snapshot_fd = -1;
+static char           *hist_snapshot;       /* live entries, one per line */
+static size_t          hist_snapshot_len;
+static int             hist_snapshot_count;
+static char           *hist_tail;           /* records since the snapshot */
+static size_t          hist_tail_len, hist_tail_alloc;
+static int             hist_tail_count;
+static int             hist_tail_lost;
+static int             hist_compact_stale;  /* the journal was replaced */
+static time_t          hist_journal_time;   /* of the last record written */
+static void hist_journal_append(const char *line, time_t t);
+static void hist_journal_compact(void);
+static void hist_journal_finish(void);
+static void hist_journal_tail(const char *recs, size_t n);
+static int  hist_journal_due(void);
+/* history store
+ *
+ * hist_line[] holds one slot per entry, oldest first. An entry used
+ * again moves to a new slot at the end and leaves a dead (NULL) slot
+ * behind. hist_table maps every live line to its slot, so duplicates
+ * are found in the whole history and each line is stored once. When
+ * the slots are used up, dead slots are squeezed out and the oldest
+ * entries past HIST_SIZE are dropped, so moving an entry and evicting
+ * are O(1) amortized.
+ */
+#define HIST_TABLE_SIZE (HIST_SIZE * 4)     /* a power of two */
        const char *hist_line[HIST_SIZE * 2];
        const char *hist_line_matched[HIST_SIZE * 2]; /* for plugin */
-       int         hist_count;
+       int         hist_count;              /* slots in use, dead ones included */
        int         hist_index;
+static int         hist_live;
+static int         hist_table[HIST_TABLE_SIZE];  /* slot + 1, 0 if empty */
+/* frecency
+ *
+ * The score of an entry is the sum of the weights of its uses, each
+ * halved every FRECENCY_HALF_LIFE seconds since. Scores are kept
+ * multiplied by 2^((now - frec_epoch) / FRECENCY_HALF_LIFE), the same
+ * factor for all, so that a use only adds to its own entry and the
+ * others do not need to be decayed. Plugin queries read the scores
+ * from their workers, so the store is changed under hist_lock.
+ */
+#define FRECENCY_HALF_LIFE (7 * 24 * 3600)
+#define FRECENCY_RESCALE   256     /* half lives before rescaling */
+static double      hist_score[HIST_SIZE * 2];
+static time_t      frec_epoch;
+static pthread_rwlock_t hist_lock = PTHREAD_RWLOCK_INITIALIZER;
+static match_refine_s hist_refine;
+/* trigram index over the history, ids are serials increasing with
+ * recency; an entry gets a new serial when it moves, the old one dies */
+static tg_index_s   hist_tg;
+static unsigned int hist_serial[HIST_SIZE * 2];
+static unsigned int hist_serial_next;
+static void hist_index_line(int index);
+static void hist_add_rec(const char *rec, size_t len, const char *line,
+                         time_t t, double weight);
 
 static void hist_plugin_init(dl_plugin_t self);
 static int  hist_plugin_query(dl_plugin_t self, const char *input);
@@ -87,6 +220,11 @@ static dl_plugin_s hist_plugin = {
 static const char *prompt_empty = "DLauncher-"VERSION;
 static char prompt_buf[BUFSIZ] = "";
 static char text[BUFSIZ] = "";
+/* the action of a Return on a plugin still busy past the deadline, run
+ * with the text once its query is done */
+static dl_plugin_t open_pending;
+static char        open_pending_text[BUFSIZ];
+static int         open_pending_mode;
 static char text_cached[BUFSIZ] = "";
 static int bh, mx, my, mw, mh;
 static int inputw, promptw;
@@ -100,8 +238,13 @@ static const char *selfgcolor  = "#eeeeee";
 static unsigned int lines = 0;
 static ColorSet *normcol;
 static ColorSet *selcol;
-static Atom clip, utf8;
+static Atom clip, utf8, net_active;
+#ifdef XRANDR
+static int randr_event = -1;    /* first event of the extension */
+#endif
 static Bool topbar = True;
+static int headless = 0;    /* no window, keys are read from stdin */
+static const char *hist_path;   /* -history, instead of ~/.dlauncher_history */
 static DC *dc;
 static Window win;
 static XIC xic;
@@ -110,7 +253,6 @@ static XIC xic;
 
 static unsigned int plugin_count = 0;
 static dl_plugin_t  plugin_entry[NPLUGIN];
-static int          plugin_update[NPLUGIN];
 static int          plugin_enabled[NPLUGIN];
 
 /* for modifying title */
@@ -119,6 +261,7 @@ static int          pt_end[NPLUGIN];
 
 static const char  *psummary_desc[NPLUGIN];
 static const char  *psummary_text[NPLUGIN];
+static double       psummary_frecency[NPLUGIN];
 static int          psummary_index[NPLUGIN];
 
 static int psummary_get_desc(dl_plugin_t self, unsigned int index, const char **output_ptr) {
@@ -177,9 +320,12 @@ process_args(int argc, char *argv[]) {
         }
         else if(!strcmp(argv[i], "-b"))   /* appears at the bottom of the screen */
             topbar = False;
+        else if(!strcmp(argv[i], "-headless")) /* render off-screen, see headless_dispatch() */
+            headless = 1;
         else if(!strcmp(argv[i], "-i")) { /* case-insensitive item matching */
             fstrncmp = strncasecmp;
             fstrstr = cistrstr;
+            match_icase = 1;
         }
         else if(i+1 == argc)
             usage();
@@ -188,6 +334,8 @@ process_args(int argc, char *argv[]) {
             lines = atoi(argv[++i]);
         else if(!strcmp(argv[i], "-fn"))  /* font or font set */
             font = strdup(argv[++i]);
+        else if(!strcmp(argv[i], "-history")) /* history journal */
+            hist_path = argv[++i];
         else if(!strcmp(argv[i], "-nb"))  /* normal background color */
             normbgcolor = strdup(argv[++i]);
         else if(!strcmp(argv[i], "-nf"))  /* normal foreground color */
@@ -305,7 +453,11 @@ main(int argc, char *argv[]) {
 
     process_args(argc - 1, argv + 1);
 
-    dc = initdc();
+    /* a headless instance runs besides the daemon, it neither uses the
+     * control socket nor the history file */
+    if (!headless) control_init(argv);
+
+    dc = headless ? initdc_headless() : initdc();
     initfont(dc, font ? font : DEFAULT_FONT);
     normcol = initcolor(dc, normfgcolor, normbgcolor);
     selcol = initcolor(dc, selfgcolor, selbgcolor);
@@ -316,19 +468,119 @@ main(int argc, char *argv[]) {
 
     signal(SIGPIPE, SIG_IGN);
     signal(SIGCHLD, SIG_IGN);
-    signal(SIGUSR1, signal_show);
+    signal_init();
+
+    /* plugins may watch fds and set timers from init() */
+    if (reactor_init())
+        eprintf("cannot create reactor\n");
 
     for (i = 0; i < plugin_count; ++ i) {
         plugin_entry[i]->init(plugin_entry[i]);
     }
 
+    if (query_init(plugin_count))
+        eprintf("cannot start query workers\n");
+
     cur_plugin = &plugin_summary;
 
+    if (headless) show();
+
     run();
 
     return 1; /* unreachable */
 }
 
+/* results of a plugin whose query is still running are not accessible */
+unsigned int
+items(dl_plugin_t plugin) {
+    return query_busy(plugin) ? 0 : plugin->item_count;
+}
+
+/* page layout of the horizontal list: page_sum[i] is the width of the
+ * items before i, extended lazily as far as paging looks; it is built
+ * for one result set and one page width */
+static dl_plugin_t   page_plugin;
+static int           page_count;
+static int           page_budget;
+static long         *page_sum;
+static unsigned int  page_len;      /* valid entries of page_sum */
+static unsigned int  page_alloc;
+
+static void
+page_reset(void) {
+    page_plugin = NULL;
+    page_len = 0;
+}
+
+static long
+page_width(unsigned int i) {
+    while (page_len <= i) {
+        if (page_len == page_alloc) {
+            unsigned int alloc = page_alloc ? page_alloc * 2 : 256;
+            long *sum = (long *)realloc(page_sum, sizeof(long) * alloc);
+            if (!sum) eprintf("cannot allocate memory for the page table\n");
+            page_sum = sum;
+            page_alloc = alloc;
+        }
+        if (page_len == 0) page_sum[0] = 0;
+        else {
+            const char *_text;
+            page_plugin->get_desc(page_plugin, page_len - 1, &_text);
+            page_sum[page_len] = page_sum[page_len - 1] + MIN(textw(dc, _text), page_budget);
+        }
+        ++ page_len;
+    }
+    return page_sum[i];
+}
+
+/* first item from [cur] that overflows the page starting at [cur], or
+ * page_count; gallops then bisects so that only about two pages are
+ * measured past [cur] */
+static int
+page_next(int cur) {
+    long base = page_width(cur);
+    int lo = cur, hi = cur, step = 1, mid;
+
+    while (hi < page_count && page_width(hi + 1) - base <= page_budget) {
+        lo = hi + 1;
+        hi += step;
+        step <<= 1;
+    }
+    if (hi > page_count) hi = page_count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (page_width(mid + 1) - base > page_budget) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+/* start of the page ending before [cur], 0 if it is the first one and
+ * -1 if there is none */
+static int
+page_prev(int cur) {
+    long base;
+    int lo, hi = cur, step = 1, mid;
+
+    if (cur <= 0) return -1;
+    base = page_width(cur);
+    /* items [hi, cur) fit in a page, the last item overflowing is
+     * searched down to 1, 0 standing for none */
+    lo = hi - step;
+    while (lo >= 1 && base - page_width(lo) <= page_budget) {
+        hi = lo;
+        step <<= 1;
+        lo = hi - step;
+    }
+    if (lo < 1) lo = 0;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (base - page_width(mid) > page_budget) lo = mid;
+        else hi = mid;
+    }
+    return lo == 0 ? 0 : lo + 1;
+}
+
 void
 calc_offsets(void) {
     if (!cur_plugin) {
@@ -336,33 +588,25 @@ calc_offsets(void) {
         return;
     }
 
-    int i, n;
-
-    if(lines > 0)
-        n = lines * bh;
-    else
-        n = mw - (promptw + inputw + textw(dc, "<") + textw(dc, ">"));
+    int count = items(cur_plugin);
 
-    /* calculate which items will begin the next page and previous page */
-    for(i = 0, next_pindex = cur_pindex;
-        next_pindex < cur_plugin->item_count;
-        ++ next_pindex) {
-        const char *_text;
-        cur_plugin->get_desc(cur_plugin, next_pindex, &_text);
-        int tw = textw(dc, _text);
-        if((i += (lines > 0) ? bh : MIN(tw, n)) > n)
-            break;
+    /* a vertical page is a fixed number of lines */
+    if (lines > 0) {
+        next_pindex = MIN(cur_pindex + lines, count);
+        prev_pindex = cur_pindex > 0 ? MAX(cur_pindex - lines, 0) : -1;
+        return;
     }
 
-    for(i = 0, prev_pindex = cur_pindex - 1; prev_pindex > 0; -- prev_pindex) {
-        const char *_text;
-        cur_plugin->get_desc(cur_plugin, prev_pindex, &_text);
-        int tw = textw(dc, _text);
-        if((i += (lines > 0) ? bh : MIN(tw, n)) > n) {
-            ++ prev_pindex;
-            break;
-        }
+    int n = mw - (promptw + inputw + textw(dc, "<") + textw(dc, ">"));
+
+    if (page_plugin != cur_plugin || page_count != count || page_budget != n) {
+        page_reset();
+        page_plugin = cur_plugin;
+        page_count  = count;
+        page_budget = n;
     }
+    next_pindex = page_next(cur_pindex);
+    prev_pindex = page_prev(cur_pindex);
 }
 
 char *
@@ -380,15 +624,87 @@ static int ru2p(int i) {
     else return 1 << (32 - __builtin_clz(i));
 }
 
+/* damage tracking
+ *
+ * The menu is tiled by cells (prompt, input, rows or horizontal items,
+ * arrows and gaps), numbered in drawing order. A cell is repainted and
+ * copied to the window only if its geometry or content differs from
+ * the cell of the same number in the last frame.
+ */
+typedef struct menu_cell_s {
+    int      x, y, w;
+    uint64_t key;
+} menu_cell_s;
+
+static menu_cell_s *menu_cell;
+static int          menu_cell_count;
+static int          menu_cell_last;     /* number of cells of the last frame */
+static int          menu_cell_alloc;
+static Pixmap       menu_canvas;        /* canvas the cells were drawn on */
+static int          menu_full;          /* repaint every cell */
+static XRectangle  *menu_damage;
+static int          menu_damage_count;
+
+static uint64_t
+cell_key(const char *s, const ColorSet *col, int extra) {
+    uint64_t h = 14695981039346656037ull;   /* FNV-1a */
+    for (; *s; ++ s)
+        h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    h = (h ^ (uintptr_t)col) * 1099511628211ull;
+    return (h ^ (unsigned int)extra) * 1099511628211ull;
+}
+
+/* draw [s] in the next cell at dc->x, dc->y of width dc->w, return
+ * non-zero if it was repainted */
+static int
+drawcell(const char *s, ColorSet *col, int extra) {
+    uint64_t key = cell_key(s, col, extra);
+    menu_cell_s *c;
+
+    if (menu_cell_count == menu_cell_alloc) {
+        int alloc = menu_cell_alloc ? menu_cell_alloc * 2 : 64;
+        menu_cell_s *p = (menu_cell_s *)realloc(menu_cell, sizeof(menu_cell_s) * alloc);
+        XRectangle *d = (XRectangle *)realloc(menu_damage, sizeof(XRectangle) * alloc);
+        if (p) menu_cell = p;
+        if (d) menu_damage = d;
+        if (!p || !d) eprintf("cannot allocate memory for the menu cells\n");
+        menu_cell_alloc = alloc;
+    }
+
+    c = &menu_cell[menu_cell_count ++];
+    if (!menu_full && menu_cell_count <= menu_cell_last && c->x == dc->x && c->y == dc->y && c->w == dc->w && c->key == key)
+        return 0;
+
+    c->x   = dc->x;
+    c->y   = dc->y;
+    c->w   = dc->w;
+    c->key = key;
+    drawtext(dc, s, col);
+
+    menu_damage[menu_damage_count].x      = dc->x;
+    menu_damage[menu_damage_count].y      = dc->y;
+    menu_damage[menu_damage_count].width  = dc->w;
+    menu_damage[menu_damage_count].height = dc->h;
+    ++ menu_damage_count;
+    return 1;
+}
+
 void
 drawmenu(void) {
     int curpos;
     int index;
 
+    /* a new canvas has nothing of the last frame */
+    if (dc->canvas != menu_canvas) {
+        menu_canvas = dc->canvas;
+        menu_full = 1;
+    }
+    menu_cell_count = 0;
+    menu_damage_count = 0;
+
     dc->x = 0;
     dc->y = 0;
     dc->h = bh;
-    drawrect(dc, 0, 0, mw, mh, True, normcol->BG);
 
     if (cur_plugin == &plugin_summary) {
         int i;
@@ -406,7 +722,7 @@ drawmenu(void) {
     if (prompt) {
         promptw = textw(dc, prompt);
         dc->w = promptw;
-        drawtext(dc, prompt, selcol);
+        drawcell(prompt, selcol, 0);
         dc->x = dc->w;
     } else promptw = 0;
 
@@ -415,55 +731,118 @@ drawmenu(void) {
 
     /* draw input field */
     dc->w = (lines > 0 || !cur_plugin) ? mw - dc->x : inputw;
-    drawtext(dc, text, normcol);
-    if((curpos = textnw(dc, text, cursor) + dc->h/2 - 2) < dc->w)
+    if (drawcell(text, normcol, cursor) &&
+        (curpos = textnw(dc, text, cursor) + dc->h/2 - 2) < dc->w)
         drawrect(dc, curpos, 2, 1, dc->h - 4, True, normcol->FG);
 
-    if(lines > 0 && cur_plugin) {
-        /* draw vertical list */
+    if(lines > 0) {
+        /* draw vertical list, blank rows included */
+        int row;
         dc->x = 0;
         dc->w = mw;
-        for(index = cur_pindex; index != next_pindex; ++ index) {
-            dc->y += dc->h;
+        for(row = 0, index = cur_pindex; row < lines; ++ row, ++ index) {
             const char *_text;
-            cur_plugin->get_desc(cur_plugin, index, &_text);
-            drawtext(dc, _text,
-                     (index == sel_index) ? selcol : normcol);
+            dc->y += dc->h;
+            if (cur_plugin && index < next_pindex) {
+                cur_plugin->get_desc(cur_plugin, index, &_text);
+                drawcell(_text, (index == sel_index) ? selcol : normcol, 0);
+            } else drawcell("", normcol, 0);
         }
     } else if (cur_plugin) {
         /* draw horizontal list */
+        int arroww = textw(dc, ">");
         dc->x += inputw;
         dc->w = textw(dc, "<");
-        if(cur_pindex > 0)
-            drawtext(dc, "<", normcol);
+        drawcell(cur_pindex > 0 ? "<" : "", normcol, 0);
         for(index = cur_pindex; index != next_pindex; ++ index) {
             const char *_text;
             cur_plugin->get_desc(cur_plugin, index, &_text);
 
             int tw = textw(dc, _text);
             dc->x += dc->w;
-            dc->w = MIN(tw, mw - dc->x - textw(dc, ">"));
-            drawtext(dc, _text,
-                     (index == sel_index) ? selcol : normcol);
+            dc->w = MIN(tw, mw - dc->x - arroww);
+            if (dc->w <= 0) {
+                dc->w = 0;
+                break;
+            }
+            drawcell(_text, (index == sel_index) ? selcol : normcol, 0);
         }
-        dc->w = textw(dc, ">");
+        /* blank between the last item and the arrow */
+        dc->x += dc->w;
+        dc->w = mw - dc->x - arroww;
+        if (dc->w > 0) drawcell("", normcol, 0);
+        dc->w = arroww;
         dc->x = mw - dc->w;
-        if(next_pindex < cur_plugin->item_count)
-            drawtext(dc, ">", normcol);
+        drawcell(next_pindex < items(cur_plugin) ? ">" : "", normcol, 0);
+    }
+
+    if (menu_full) mapdc(dc, win, mw, mh);
+    else for (index = 0; index < menu_damage_count; ++ index)
+        mapdcrect(dc, win, menu_damage[index].x, menu_damage[index].y,
+                  menu_damage[index].width, menu_damage[index].height);
+    menu_cell_last = menu_cell_count;
+    menu_full = 0;
+}
+
+/* the keyboard may be held by another client for a while, the grab is
+ * then retried from the reactor so that plugins keep running */
+static int    grab_timer = -1;
+static double grab_start;
+
+static int
+grab_try(void) {
+    if(XGrabKeyboard(dc->dpy, DefaultRootWindow(dc->dpy), True,
+                     GrabModeAsync, GrabModeAsync, CurrentTime) != GrabSuccess)
+        return 0;
+    stats_add(&stats_grab, stats_now() - grab_start);
+    return 1;
+}
+
+static void
+grab_cancel(void) {
+    if (grab_timer < 0) return;
+    reactor_del(grab_timer);
+    close(grab_timer);
+    grab_timer = -1;
+}
+
+static void
+grab_dispatch(int fd, int event, void *ctx) {
+    uint64_t expired;
+
+    if (read(fd, &expired, sizeof(expired)) < 0 && errno == EAGAIN) return;
+    if (grab_try()) grab_cancel();
+    else if (stats_now() - grab_start > GRAB_TIMEOUT_MS) {
+        grab_cancel();
+        fprintf(stderr, "cannot grab keyboard\n");
+        hide();
     }
-    mapdc(dc, win, mw, mh);
 }
 
 void
 grabkeyboard(void) {
     int i;
 
-    /* try to grab keyboard, we may have to wait for another process to ungrab */
-    for(i = 0; i < 1000; i++) {
-        if(XGrabKeyboard(dc->dpy, DefaultRootWindow(dc->dpy), True,
-                         GrabModeAsync, GrabModeAsync, CurrentTime) == GrabSuccess)
+    grab_cancel();
+    grab_start = stats_now();
+    if (grab_try()) return;
+
+#ifdef __linux__
+    struct itimerspec its;
+    its.it_value.tv_sec = its.it_interval.tv_sec = 0;
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = GRAB_RETRY_MS * 1000000L;
+    if ((grab_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) >= 0) {
+        if (timerfd_settime(grab_timer, 0, &its, NULL) == 0 &&
+            reactor_add(grab_timer, REACTOR_READ, &grab_dispatch, NULL) == 0)
             return;
-        usleep(1000);
+        close(grab_timer);
+        grab_timer = -1;
+    }
+#endif
+    /* no timer, wait here for another process to ungrab */
+    for(i = 0; i < GRAB_TIMEOUT_MS / GRAB_RETRY_MS; i++) {
+        usleep(GRAB_RETRY_MS * 1000);
+        if (grab_try()) return;
     }
     eprintf("cannot grab keyboard\n");
 }
@@ -477,7 +856,38 @@ insert(const char *str, ssize_t n) {
     if(n > 0)
         memcpy(&text[cursor], str, n);
     cursor += n;
-    update(1);
+    /* queried once all pending events are applied, see run() */
+    query_dirty = 1;
+}
+
+/* run the action of a plugin; a headless run only reports it, it must
+ * not launch anything */
+static void
+open_item(dl_plugin_t plugin, int index, const char *input, int mode) {
+    if (headless && plugin != &hist_plugin) {
+        printf("open %s:%s%s\n", plugin->name, input, mode ? " (shift)" : "");
+        fflush(stdout);
+        return;
+    }
+    plugin->open(plugin, index, input, mode);
+}
+
+/* run the action held back by Return once its plugin is done */
+static void
+open_flush(void) {
+    dl_plugin_t plugin = open_pending;
+
+    if (!plugin || query_busy(plugin)) return;
+    open_pending = NULL;
+    open_item(plugin, -1, open_pending_text, open_pending_mode);
+}
+
+/* return non-zero if the key only edits the text */
+static int
+editkey(unsigned int state, KeySym ksym, const char *buf, int len) {
+    if (state & (ControlMask | Mod1Mask)) return 0;
+    if (ksym == XK_BackSpace || ksym == XK_Delete) return 1;
+    return len > 0 && !iscntrl((unsigned char)*buf);
 }
 
 void
@@ -490,7 +900,16 @@ keypress(XKeyEvent *ev) {
     len = XmbLookupString(xic, ev, buf, sizeof buf, &ksym, &status);
     if(status == XBufferOverflow)
         return;
-    if(ev->state & ControlMask)
+    keysym_press(ksym, ev->state, buf, len);
+}
+
+/* handle a key whose text is [buf] of [len] bytes */
+void
+keysym_press(KeySym ksym, unsigned int state, char *buf, int len) {
+    /* anything but editing works on the results of the current text */
+    if (!editkey(state, ksym, buf, len))
+        flush_query();
+    if(state & ControlMask)
         switch(ksym) {
         case XK_a: ksym = XK_Home;      break;
         case XK_b: ksym = XK_Left;      break;
@@ -522,13 +941,14 @@ keypress(XKeyEvent *ev) {
                 insert(NULL, nextrune(-1) - cursor);
             break;
         case XK_y: /* paste selection */
-            XConvertSelection(dc->dpy, (ev->state & ShiftMask) ? clip : XA_PRIMARY,
+            if (headless) return;
+            XConvertSelection(dc->dpy, (state & ShiftMask) ? clip : XA_PRIMARY,
                               utf8, utf8, win, CurrentTime);
             return;
         default:
             return;
         }
-    else if(ev->state & Mod1Mask)
+    else if(state & Mod1Mask)
         switch(ksym) {
         case XK_g:     ksym = XK_Home;  break;
         case XK_G:     ksym = XK_End;   break;
@@ -570,7 +990,7 @@ keypress(XKeyEvent *ev) {
             break;
         }
         if (cur_plugin) {
-            cur_pindex = cur_plugin->item_count;
+            cur_pindex = items(cur_plugin);
             calc_offsets();
             sel_index = cur_pindex = prev_pindex;
             calc_offsets();
@@ -612,7 +1032,7 @@ keypress(XKeyEvent *ev) {
         break;
     case XK_Next:
         if(!cur_plugin ||
-           next_pindex >= cur_plugin->item_count)
+           next_pindex >= items(cur_plugin))
             return;
         sel_index = cur_pindex = next_pindex;
         calc_offsets();
@@ -629,7 +1049,7 @@ keypress(XKeyEvent *ev) {
     open:
         if (cur_plugin == &plugin_summary) {
             if (sel_index < 0) sel_index = 0;
-            if (sel_index < cur_plugin->item_count) {
+            if (sel_index < items(cur_plugin)) {
                 const char *_text;
                 cur_plugin->get_text(cur_plugin, sel_index, &_text);
                 strncpy(text, _text, sizeof text);
@@ -640,15 +1060,22 @@ keypress(XKeyEvent *ev) {
             }
             return;
         } else if (cur_plugin) {
-            if (sel_index >= 0 && sel_index < cur_plugin->item_count) {
+            /* the action needs the results of the current input, but a
+             * stuck plugin must not hold up Return */
+            if (query_wait_plugin(cur_plugin, QUERY_DEADLINE_MS)) {
+                if (cur_plugin->hist) hist_add(cur_plugin->name, text);
+                open_pending = cur_plugin;
+                strcpy(open_pending_text, text);
+                open_pending_mode = !!(state & ShiftMask);
+            } else if (sel_index >= 0 && sel_index < items(cur_plugin)) {
                 const char *_text;
                 cur_plugin->get_text(cur_plugin, sel_index, &_text);
                 if (cur_plugin->hist) hist_add(cur_plugin->name, _text);
-                cur_plugin->open(cur_plugin, sel_index, _text, !!(ev->state & ShiftMask));
+                open_item(cur_plugin, sel_index, _text, !!(state & ShiftMask));
             } else {
                 /* no selected item */
                 if (cur_plugin->hist) hist_add(cur_plugin->name, text);
-                cur_plugin->open(cur_plugin, -1, text, !!(ev->state & ShiftMask));
+                open_item(cur_plugin, -1, text, !!(state & ShiftMask));
             }
         }
         hide();
@@ -665,17 +1092,18 @@ keypress(XKeyEvent *ev) {
     case XK_Down: item_sel_next(); break;
     case XK_Tab: complete_text(1); return;
     }
-    drawmenu();
+    if (!query_dirty)
+        drawmenu();
 }
 
 void
 item_sel_next(void) {
     if (cur_plugin < 0) return;
     if (sel_index < 0) sel_index = cur_pindex;
-    else if (sel_index + 1 < cur_plugin->item_count) {
+    else if (sel_index + 1 < items(cur_plugin)) {
         ++ sel_index;
         if (sel_index == next_pindex &&
-            next_pindex < cur_plugin->item_count) {
+            next_pindex < items(cur_plugin)) {
             cur_pindex = next_pindex;
             calc_offsets();
         }
@@ -688,10 +1116,10 @@ item_sel_next(void) {
 
 void
 complete_text(int to_update) {
-    if (!cur_plugin || cur_plugin->item_count == 0)
+    if (!cur_plugin || items(cur_plugin) == 0)
         return;
     if (sel_index < 0 ||
-        sel_index >= cur_plugin->item_count)
+        sel_index >= items(cur_plugin))
         sel_index = 0;
 
     const char *_text;
@@ -727,12 +1155,21 @@ complete_text(int to_update) {
 
 static int
 psummary_comp(const void *a, const void *b) {
+    double fa = psummary_frecency[*(int *)a];
+    double fb = psummary_frecency[*(int *)b];
     int pa = plugin_entry[*(int *)a]->priority;
     int pb = plugin_entry[*(int *)b]->priority;
-    /* larger priority first */
+    /* the most used first, then larger priority first */
+    if (fa != fb) return fa < fb ? 1 : -1;
     return (pb - pa);
 }
 
+void
+flush_query(void) {
+    if (query_dirty)
+        update(1);
+}
+
 void
 update(int query) {
     char *prompt_ptr = prompt_buf;
@@ -747,18 +1184,32 @@ update(int query) {
     }
 
     int p;
+    /* results may change below, even with the same count */
+    page_reset();
+    if (query) {
+        query_dirty = 0;
+        ++ query_generation;
+        for (p = 0; p < plugin_count; ++ p) {
+            if (plugin_filter && strstr(plugin_entry[p]->name, text) == NULL) continue;
+            query_submit(plugin_entry[p], query_generation, input);
+        }
+        query_wait(QUERY_DEADLINE_MS);
+    }
+
     plugin_summary.item_count = 0;
     for (p = 0; p < plugin_count; ++ p) {
         if (plugin_filter && strstr(plugin_entry[p]->name, text) == NULL) goto skip;
-        if (query) {
-            if (plugin_entry[p]->query(plugin_entry[p], input)) goto skip;
-        }
+        /* a plugin still busy stays enabled with no result for now */
+        int busy = query_busy(plugin_entry[p]);
+        if (!busy && query_result(plugin_entry[p])) goto skip;
 
-        if (plugin_entry[p]->item_count > 0) {
+        if (!busy && plugin_entry[p]->item_count > 0) {
             plugin_entry[p]->get_desc(plugin_entry[p],
                                       0, &psummary_desc[p]);
             plugin_entry[p]->get_text(plugin_entry[p],
                                       0, &psummary_text[p]);
+            psummary_frecency[p] = plugin_entry[p]->hist ?
+                dl_frecency(plugin_entry[p], psummary_text[p]) : 0;
             psummary_index[plugin_summary.item_count] = p;
             ++ plugin_summary.item_count;
         }
@@ -835,104 +1286,551 @@ paste(void) {
                        utf8, &da, &di, &dl, &dl, (unsigned char **)&p);
     insert(p, (q = strchr(p, '\n')) ? q-p : (ssize_t)strlen(p));
     XFree(p);
-    drawmenu();
+}
+
+/* replay the journal record [rec] of [len] bytes, not terminated */
+static void
+hist_replay(const char *rec, size_t len, time_t *t, double *weight) {
+    if (rec[0] == '@') {
+        char buf[64];
+        long long lt;
+        if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+        memcpy(buf, rec, len);
+        buf[len] = 0;
+        int n = sscanf(buf + 1, "%lld %lf", &lt, weight);
+        if (n >= 1) *t = lt;
+        if (n < 2) *weight = 1;
+        return;
+    }
+    /* not an entry, e.g. the rest of a line cut by a newline, or a
+     * corrupt one with a NUL, which hist_lookup() cannot compare */
+    if (memchr(rec, ':', len) && !memchr(rec, 0, len))
+        hist_add_rec(rec, len, NULL, *t, *weight);
+    *weight = 1;
+}
+
+/* map the journal open at [fd] and replay it, records without a time
+ * are from now; return non-zero if its last line is not terminated */
+static int
+hist_load(int fd) {
+    struct stat st;
+    time_t t = frec_epoch;
+    double weight = 1;
+    const char *map, *p, *end, *nl;
+    int unterminated = 0;
+
+    hist_journal_end = 0;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) return 0;
+    /* only the lines not in the history yet are copied out of it */
+    map = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return 0;
+    hist_journal_end = st.st_size;
+
+    end = map + st.st_size;
+    for (p = map; p < end; p = nl + 1) {
+        nl = (const char *)memchr(p, '\n', end - p);
+        if (!nl) {
+            /* a time record may have been cut short */
+            if (p[0] != '@') hist_replay(p, end - p, &t, &weight);
+            unterminated = 1;
+            break;
+        }
+        hist_replay(p, nl - p, &t, &weight);
+    }
+    munmap((void *)map, st.st_size);
+    return unterminated;
+}
+
+/* drop the whole history */
+static void
+hist_clear(void) {
+    int i;
+
+    pthread_rwlock_wrlock(&hist_lock);
+    match_refine_reset(&hist_refine, 0);
+    hist_index = -1;
+    for (i = 0; i < hist_count; ++ i)
+        free((void *)hist_line[i]);
+    memset(hist_table, 0, sizeof(hist_table));
+    hist_count = hist_live = 0;
+    tg_clear(&hist_tg);
+    /* the results point to the lines */
+    hist_plugin.item_count = 0;
+    pthread_rwlock_unlock(&hist_lock);
+}
+
+/* load the journal just opened, over what was loaded before */
+static void
+hist_reload(void) {
+    hist_clear();
+    hist_journal_count = 0;
+    hist_compact_next = 0;
+    hist_loading = 1;
+    if (hist_load(fileno(hist_file)) && fputc('\n', hist_file) != EOF &&
+        fflush(hist_file) == 0)
+        ++ hist_journal_end;
+    hist_loading = 0;
+    /* the records made since, if any, start with their time */
+    hist_journal_time = 0;
+    /* a snapshot being written is of the history replaced */
+    if (hist_compacting) hist_compact_stale = 1;
+}
+
+/* replay the records other instances appended to the journal, up to
+ * [size]; while compacting they go to the tail as well */
+static void
+hist_journal_catch_up(off_t size) {
+    size_t len = size - hist_journal_end, n = 0;
+    time_t t = time(NULL);
+    double weight = 1;
+    char *buf, *p, *end, *nl;
+
+    buf = (char *)malloc(len);
+    if (!buf) return;
+    while (n < len) {
+        ssize_t r = pread(fileno(hist_file), buf + n, len - n, hist_journal_end + n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        n += r;
+    }
+    /* complete records only, a partial one is read again next time */
+    end = (char *)memrchr(buf, '\n', n);
+    if (!end) goto done;
+    ++ end;
+    if (hist_compacting) hist_journal_tail(buf, end - buf);
+
+    hist_loading = 1;
+    for (p = buf; p < end; p = nl + 1) {
+        nl = (char *)memchr(p, '\n', end - p);
+        if (p[0] != '@' && hist_compacting) ++ hist_tail_count;
+        hist_replay(p, nl - p, &t, &weight);
+    }
+    hist_loading = 0;
+    hist_journal_end += end - buf;
+    hist_journal_time = 0;
+
+  done:
+    free(buf);
+}
+
+/* open the journal if it is not, and lock it against the other
+ * instances; return -1 if it is not to be written */
+static int
+hist_journal_lock(void) {
+    struct stat fst, st;
+    int fresh = 0;
+
+    if (!hist_file_path || hist_loading) return -1;
+    for (;;) {
+        if (!hist_file) {
+            hist_file = fopen(hist_file_path, "a+e");
+            if (!hist_file) {
+                fprintf(stderr, "cannot open %s\n", hist_file_path);
+                return -1;
+            }
+            fresh = 1;
+        }
+        while (flock(fileno(hist_file), LOCK_EX) != 0)
+            if (errno != EINTR) return -1;
+        if (fstat(fileno(hist_file), &fst) == 0 && stat(hist_file_path, &st) == 0 &&
+            fst.st_dev == st.st_dev && fst.st_ino == st.st_ino)
+            break;
+        /* replaced by another instance */
+        fclose(hist_file);
+        hist_file = NULL;
+    }
+
+    if (fresh) hist_reload();
+    else if (fst.st_size > hist_journal_end) hist_journal_catch_up(fst.st_size);
+    return 0;
 }
 
 void
 hist_plugin_init(dl_plugin_t self) {
     hist_index = -1;
     hist_count = 0;
+    hist_live = 0;
     hist_file = NULL;
-
+    hist_journal_count = 0;
+    hist_journal_end = 0;
+    frec_epoch = time(NULL);
+    match_refine_init(&hist_refine);
+    tg_init(&hist_tg);
+    hist_serial_next = 0;
+
+    /* a headless run keeps its history in memory unless given a file,
+     * the user's file belongs to the daemon */
     const char *home_dir = getenv("HOME");
-    if (home_dir == NULL) goto skip_history;
-
     hist_file_path = NULL;
-    asprintf(&hist_file_path, "%s/.dlauncher_history", home_dir);
+    if (hist_path) hist_file_path = strdup(hist_path);
+    else if (!headless && home_dir)
+        asprintf(&hist_file_path, "%s/.dlauncher_history", home_dir);
     if (hist_file_path == NULL) goto skip_history;
-    FILE *his_r = fopen(hist_file_path, "r");
-    if (his_r == NULL) goto skip_history;
-
-    char *line = NULL; size_t line_size; ssize_t gl_ret;
-    while ((gl_ret = getline(&line, &line_size, his_r)) >= 0) {
-        if (gl_ret > 0 && line[gl_ret - 1] == '\n')
-            line[gl_ret - 1] = 0;
-        char *h = strdup(line);
-        if (h) hist_add_line(h);
-        else break;
+    asprintf(&hist_journal_tmp, "%s.tmp", hist_file_path);
+    if (hist_journal_tmp == NULL) {
+        free(hist_file_path);
+        hist_file_path = NULL;
+        goto skip_history;
     }
-    if (line) free(line);
 
-    fclose(his_r);
+    /* opening it loads it; a temp file left over by a compaction that
+     * did not complete is truncated by the next one */
+    if (hist_journal_lock() != 0) goto skip_history;
+    flock(fileno(hist_file), LOCK_UN);
+    if (hist_journal_due())
+        hist_journal_compact();
 
   skip_history:
-    hist_file = fopen(hist_file_path, "a");
+    return;
 }
 
 void
 hist_add(const char *name, const char *text) {
     if (strcmp(name, "hist") == 0) return;
+    /* the journal has a record per line, a 'B' item may not fit */
+    if (strchr(text, '\n')) return;
 
     char *line;
     asprintf(&line, "%s:%s", name, text);
-    if (line) hist_add_line(line);
+    if (line) hist_add_line(line, time(NULL), 1);
 }
 
-void
-hist_add_line(const char *line) {
+#define HIST_HASH_BASIS 2166136261u
+
+/* FNV-1a of the [n] bytes at [s], continued from [h] */
+static unsigned int
+hist_hash(const char *s, size_t n, unsigned int h) {
+    for (; n > 0; ++ s, -- n)
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+/* return the table entry of the [len] bytes of [line], which has no
+ * NUL in them, or the empty one to add it at */
+static int *
+hist_lookup(const char *line, size_t len) {
+    unsigned int i = hist_hash(line, len, HIST_HASH_BASIS) & (HIST_TABLE_SIZE - 1);
+    while (hist_table[i]) {
+        const char *l = hist_line[hist_table[i] - 1];
+        if (strncmp(l, line, len) == 0 && l[len] == 0) break;
+        i = (i + 1) & (HIST_TABLE_SIZE - 1);
+    }
+    return &hist_table[i];
+}
+
+/* return the slot of the line [name]:[text], or -1, without building it */
+static int
+hist_find(const char *name, const char *text) {
+    size_t n = strlen(name);
+    unsigned int i = hist_hash(name, n, HIST_HASH_BASIS);
+    i = hist_hash(text, strlen(text), hist_hash(":", 1, i));
+
+    for (i &= HIST_TABLE_SIZE - 1; hist_table[i]; i = (i + 1) & (HIST_TABLE_SIZE - 1)) {
+        const char *line = hist_line[hist_table[i] - 1];
+        if (strncmp(line, name, n) == 0 && line[n] == ':' && strcmp(line + n + 1, text) == 0)
+            return hist_table[i] - 1;
+    }
+    return -1;
+}
+
+/* return the weight of a use at [t] in the units of the scores */
+static double
+frecency_scale(time_t t) {
     int i;
-    for (i = hist_count - 1;
-         i >= 0 && i >= hist_count - HIST_CMP_MAX; -- i) {
-        if (strcmp(line, hist_line[i]) == 0) {
-            free((void *)line);
 
-            int j;
-            line = hist_line[i];
-            for (j = i; j < hist_count - 1; ++ j)
-                hist_line[j] = hist_line[j + 1];
-            hist_line[hist_count - 1] = line;
+    if (t - frec_epoch > (time_t)FRECENCY_RESCALE * FRECENCY_HALF_LIFE) {
+        /* move the epoch before the factor overflows */
+        double f = exp2(-(double)(t - frec_epoch) / FRECENCY_HALF_LIFE);
+        for (i = 0; i < hist_count; ++ i) hist_score[i] *= f;
+        frec_epoch = t;
+    }
+    return exp2((double)(t - frec_epoch) / FRECENCY_HALF_LIFE);
+}
+
+double
+dl_frecency(dl_plugin_t plugin, const char *text) {
+    double score = 0;
+    int slot;
+
+    pthread_rwlock_rdlock(&hist_lock);
+    slot = hist_find(plugin->name, text);
+    if (slot >= 0) score = hist_score[slot];
+    pthread_rwlock_unlock(&hist_lock);
+    return score;
+}
+
+/* squeeze out the dead slots and drop the oldest entries past
+ * HIST_SIZE, return non-zero if any was dropped */
+static int
+hist_compact(void) {
+    int i, n = 0, drop = hist_live - HIST_SIZE;
+
+    memset(hist_table, 0, sizeof(hist_table));
+    for (i = 0; i < hist_count; ++ i) {
+        if (!hist_line[i]) continue;
+        if (drop > 0) {
+            free((void *)hist_line[i]);
+            -- drop;
+            continue;
+        }
+        hist_line[n] = hist_line[i];
+        hist_serial[n] = hist_serial[i];
+        hist_score[n] = hist_score[i];
+        *hist_lookup(hist_line[n], strlen(hist_line[n])) = n + 1;
+        ++ n;
+    }
+    drop = hist_live - n;
+    hist_count = hist_live = n;
+    return drop > 0;
+}
+
+void
+hist_add_line(const char *line, time_t t, double weight) {
+    hist_add_rec(line, strlen(line), line, t, weight);
+}
 
-            hist_rebuild_file();
+/* add the [len] bytes of [rec]; [line] is them as a string that the
+ * history takes, or NULL to copy them if they are not in it yet */
+static void
+hist_add_rec(const char *rec, size_t len, const char *line, time_t t, double weight) {
+    int *entry, slot;
+    /* the records of other instances go before this one */
+    int record = hist_journal_lock() == 0;
+
+    pthread_rwlock_wrlock(&hist_lock);
+    /* indexes are about to change */
+    match_refine_reset(&hist_refine, 0);
+    hist_index = -1;
+
+    if (hist_count >= HIST_SIZE * 2)
+        hist_compact();
+
+    weight *= frecency_scale(t);
+    entry = hist_lookup(rec, len);
+    if (*entry) {
+        /* move to the end */
+        slot = *entry - 1;
+        free((void *)line);
+        line = hist_line[slot];
+        hist_line[slot] = NULL;
+        hist_line[hist_count] = line;
+        hist_score[hist_count] = hist_score[slot] + weight;
+    } else {
+        if (!line && !(line = strndup(rec, len))) {
+            pthread_rwlock_unlock(&hist_lock);
+            if (record) flock(fileno(hist_file), LOCK_UN);
             return;
         }
+        hist_line[hist_count] = line;
+        hist_score[hist_count] = weight;
+        ++ hist_live;
     }
+    *entry = ++ hist_count;
+    hist_index_line(hist_count - 1);
+    pthread_rwlock_unlock(&hist_lock);
 
-    if (hist_count >= HIST_SIZE * 2) {
+    if (record) hist_journal_append(line, t);
+    else ++ hist_journal_count;
+}
+
+void
+hist_index_line(int index) {
+    hist_serial[index] = hist_serial_next ++;
+
+    /* too many dead serials, rebuild from the live entries */
+    if (hist_tg.id_count > hist_count * 2 + HIST_SIZE) {
         int i;
-        for (i = 0; i < HIST_SIZE; ++ i) {
-            free((void *)hist_line[i]);
-            hist_line[i] = hist_line[i + HIST_SIZE];
+        tg_clear(&hist_tg);
+        for (i = 0; i < hist_count; ++ i)
+            if (hist_line[i])
+                tg_add(&hist_tg, hist_serial[i], strchr(hist_line[i], ':') + 1);
+    } else tg_add(&hist_tg, hist_serial[index], strchr(hist_line[index], ':') + 1);
+}
+
+static int
+write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t r = write(fd, buf, len);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
         }
-        hist_count -= HIST_SIZE;
-        hist_rebuild_file();
+        buf += r;
+        len -= r;
     }
+    return 0;
+}
 
-    hist_line[hist_count] = line;
-    ++ hist_count;
-    hist_index = -1;
+static void *
+hist_compact_thread(void *arg) {
+    int ok = write_all(hist_snapshot_fd, hist_snapshot, hist_snapshot_len) == 0 &&
+        fdatasync(hist_snapshot_fd) == 0;
+
+    pthread_mutex_lock(&hist_compact_lock);
+    hist_compact_done = ok ? 1 : -1;
+    pthread_mutex_unlock(&hist_compact_lock);
+    return NULL;
+}
+
+/* return non-zero if the journal is to be compacted */
+static int
+hist_journal_due(void) {
+    return hist_journal_count > hist_live + HIST_JOURNAL_SLACK &&
+        hist_journal_count >= hist_compact_next;
+}
+
+/* snapshot the live entries and write them out in the background */
+static void
+hist_journal_compact(void) {
+    time_t now = time(NULL);
+    double scale = exp2((double)(frec_epoch - now) / FRECENCY_HALF_LIFE);
+    int i;
 
-    if (hist_file) {
-        fputs(line, hist_file);
-        fputc('\n', hist_file);
-        fflush(hist_file);
+    /* a failed attempt is not made again on every record */
+    hist_compact_next = hist_journal_count + HIST_JOURNAL_SLACK;
+
+    /* another instance may be compacting into the same temp file, the
+     * one holding its lock owns it until renamed */
+    struct stat fst, st;
+    hist_snapshot_fd = open(hist_journal_tmp, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (hist_snapshot_fd < 0) return;
+    if (flock(hist_snapshot_fd, LOCK_EX | LOCK_NB) != 0 ||
+        fstat(hist_snapshot_fd, &fst) != 0 || stat(hist_journal_tmp, &st) != 0 ||
+        fst.st_dev != st.st_dev || fst.st_ino != st.st_ino ||
+        ftruncate(hist_snapshot_fd, 0) != 0) {
+        close(hist_snapshot_fd);
+        hist_snapshot_fd = -1;
+        return;
+    }
+
+    /* each entry with its score as of now */
+    FILE *f = open_memstream(&hist_snapshot, &hist_snapshot_len);
+    if (!f) goto fail;
+    hist_snapshot_count = 0;
+    for (i = 0; i < hist_count; ++ i) {
+        if (!hist_line[i]) continue;
+        fprintf(f, "@%lld %.9g\n%s\n", (long long)now, hist_score[i] * scale, hist_line[i]);
+        ++ hist_snapshot_count;
     }
+    if (fclose(f) != 0) goto fail;
+
+    hist_compact_done = 0;
+    hist_tail_len = 0;
+    hist_tail_count = 0;
+    hist_tail_lost = 0;
+    hist_compact_stale = 0;
+    /* the tail starts with the time of its first record */
+    hist_journal_time = 0;
+    if (pthread_create(&hist_compactor, NULL, &hist_compact_thread, NULL) != 0)
+        goto fail;
+    hist_compacting = 1;
+    return;
+
+  fail:
+    /* unlinked while still locked, as in hist_journal_finish() */
+    unlink(hist_journal_tmp);
+    close(hist_snapshot_fd);
+    hist_snapshot_fd = -1;
+    free(hist_snapshot);
+    hist_snapshot = NULL;
 }
 
+/* once the snapshot is written, complete it with the tail and put it
+ * in place of the journal */
 void
-hist_rebuild_file(void) {
-    int i;
-    if (hist_file) {
-        hist_file = freopen(hist_file_path, "w", hist_file);
-        if (hist_file) {
-            for (i = 0; i < hist_count; ++ i) {
-                fputs(hist_line[i], hist_file);
-                fputc('\n', hist_file);
-            }
-            fflush(hist_file);
+hist_journal_finish(void) {
+    int done, ok = 0;
+
+    if (!hist_compacting) return;
+    pthread_mutex_lock(&hist_compact_lock);
+    done = hist_compact_done;
+    pthread_mutex_unlock(&hist_compact_lock);
+    if (!done) return;
+
+    pthread_join(hist_compactor, NULL);
+    /* no record may be appended to the journal from here to the rename,
+     * and those appended since the snapshot join the tail */
+    if (done > 0 && hist_journal_lock() == 0) {
+        if (!hist_tail_lost && !hist_compact_stale &&
+            write_all(hist_snapshot_fd, hist_tail, hist_tail_len) == 0 &&
+            (hist_tail_len == 0 || fdatasync(hist_snapshot_fd) == 0) &&
+            rename(hist_journal_tmp, hist_file_path) == 0) {
+            hist_journal_count = hist_snapshot_count + hist_tail_count;
+            hist_journal_end = hist_snapshot_len + hist_tail_len;
+            ok = 1;
         }
+        if (ok) {
+            /* appending to the old handle would go to the replaced file,
+             * the next append opens the new one if this fails */
+            fclose(hist_file);
+            hist_file = fopen(hist_file_path, "a+e");
+            if (!hist_file) fprintf(stderr, "cannot open %s\n", hist_file_path);
+        } else flock(fileno(hist_file), LOCK_UN);
+    }
+    hist_compacting = 0;
+    /* unlinked while still locked, so no other instance has taken it */
+    if (!ok) unlink(hist_journal_tmp);
+    close(hist_snapshot_fd);
+    hist_snapshot_fd = -1;
+    if (!ok && !hist_compact_stale)
+        fprintf(stderr, "cannot compact %s\n", hist_file_path);
+    hist_compact_stale = 0;
+    free(hist_snapshot);
+    hist_snapshot = NULL;
+}
+
+/* add [n] bytes of records to the tail */
+static void
+hist_journal_tail(const char *recs, size_t n) {
+    if (hist_tail_len + n > hist_tail_alloc) {
+        size_t alloc = hist_tail_alloc ? hist_tail_alloc : 4096;
+        while (alloc < hist_tail_len + n) alloc <<= 1;
+        char *t = (char *)realloc(hist_tail, alloc);
+        if (!t) {
+            hist_tail_lost = 1;
+            return;
+        }
+        hist_tail = t;
+        hist_tail_alloc = alloc;
+    }
+    memcpy(hist_tail + hist_tail_len, recs, n);
+    hist_tail_len += n;
+}
+
+/* write [rec] to the journal, and to the tail while compacting */
+static void
+hist_journal_record(const char *rec) {
+    size_t n = strlen(rec);
+
+    fputs(rec, hist_file);
+    fputc('\n', hist_file);
+    hist_journal_end += n + 1;
+
+    if (hist_compacting) {
+        hist_journal_tail(rec, n);
+        hist_journal_tail("\n", 1);
     }
 }
 
+/* record [line] in the journal, which the caller has locked */
+void
+hist_journal_append(const char *line, time_t t) {
+    if (t != hist_journal_time) {
+        char rec[32];
+        snprintf(rec, sizeof(rec), "@%lld", (long long)t);
+        hist_journal_record(rec);
+        hist_journal_time = t;
+    }
+    hist_journal_record(line);
+    fflush(hist_file);
+    flock(fileno(hist_file), LOCK_UN);
+    ++ hist_journal_count;
+
+    if (hist_compacting) ++ hist_tail_count;
+    else if (hist_journal_due())
+        hist_journal_compact();
+}
+
 void
 hist_apply(const char *line) {
     int p_index;
@@ -951,36 +1849,82 @@ hist_apply(const char *line) {
 
 void
 hist_show_prev(void) {
-    if (hist_index == -1) hist_index = hist_count;
-    if (hist_index == -1) return;
-    if (hist_index > 0) -- hist_index;
+    int i = (hist_index == -1) ? hist_count : hist_index;
+
+    /* the previous live entry, or stay on the oldest */
+    while (-- i >= 0 && !hist_line[i]);
+    if (i < 0) {
+        if (hist_index == -1) return;
+        i = hist_index;
+    }
+    hist_index = i;
     hist_apply(hist_line[hist_index]);
     update(1);
 }
 
 void
 hist_show_next(void) {
-    if (hist_index == -1) hist_index = hist_count - 1;
-    if (hist_index == -1) return;
-    if (hist_index < hist_count - 1) ++ hist_index;
+    int i;
+
+    /* the next live entry, the last slot always is one */
+    if (hist_index == -1) i = hist_count - 1;
+    else for (i = hist_index + 1; i < hist_count && !hist_line[i]; ++ i);
+    if (i < 0) return;
+    if (i >= hist_count) i = hist_index;
+    hist_index = i;
     hist_apply(hist_line[hist_index]);
     update(1);
 }
 
+static int
+hist_plugin_test(void *ctx, unsigned int index, const char *input) {
+    return hist_line[index] &&
+        match_strstr(strchr(hist_line[index], ':') + 1, input) != NULL;
+}
+
+static int
+hist_serial_comp(const void *a, const void *b) {
+    unsigned int sa = *(const unsigned int *)a, sb = *(const unsigned int *)b;
+    return sa < sb ? -1 : sa > sb;
+}
+
 int
 hist_plugin_query(dl_plugin_t self, const char *input) {
-    int count = 0;
-    int i;
-    for (i = hist_count - 1; i >= 0; -- i)
-        if (strstr(strchr(hist_line[i], ':') + 1, input))
-            hist_line_matched[count ++] = hist_line[i];
+    const unsigned int *result;
+    unsigned int count, i;
+
+    if (tg_query(&hist_tg, input, &result, &count) == 0) {
+        /* verify the candidates, most recent first */
+        int matched = 0;
+        for (i = count; i-- > 0; ) {
+            const unsigned int *s = bsearch(&result[i], hist_serial, hist_count,
+                                            sizeof(unsigned int), &hist_serial_comp);
+            if (!s) continue;
+            const char *line = hist_line[s - hist_serial];
+            if (line && match_strstr(strchr(line, ':') + 1, input))
+                hist_line_matched[matched ++] = line;
+        }
+        self->item_count = matched;
+        return 0;
+    }
+
+    if (hist_refine.corpus != hist_count)
+        match_refine_reset(&hist_refine, hist_count);
+    match_refine(&hist_refine, input, &hist_plugin_test, NULL, &result, &count);
+
+    /* most recent first */
+    for (i = 0; i < count; ++ i)
+        hist_line_matched[i] = hist_line[result[count - 1 - i]];
 
     self->item_count = count;
     return 0;
 }
 
 int
-hist_plugin_before_update(dl_plugin_t self) { return 0; }
+hist_plugin_before_update(dl_plugin_t self) {
+    hist_journal_finish();
+    return 0;
+}
 
 int
 hist_plugin_get_desc(dl_plugin_t self, unsigned int index, const char **output_ptr)
@@ -1019,73 +1963,479 @@ hist_plugin_open(dl_plugin_t self, int index, const char *input, int mode) {
     hist_apply(hist_line_matched[index]);
     if (cur_plugin != self) {
         hist_add(cur_plugin->name, text);
-        cur_plugin->open(cur_plugin, -1, text, mode);
+        open_item(cur_plugin, -1, text, mode);
     }
     return 0;
 }
 
-fd_set in_fds, out_fds, stat_fds;
-int    max_fd;
-int    fd_alloc;
-int    fd_size;
-int   *fd_plugin;
-int   *fds;
-int   *fd_flags;
+/* a fd monitored for a plugin */
+typedef struct fd_watch_s {
+    int              plugin;
+    dl_fd_callback_t callback;  /* NULL to call update() */
+    void            *data;
+} fd_watch_s;
+
+/* some plugin changed its results from a fd callback */
+static int fd_redraw;
+
+static void
+fd_dispatch(int fd, int event, void *ctx) {
+    fd_watch_s *w = (fd_watch_s *)ctx;
+    dl_plugin_t plugin = plugin_entry[w->plugin];
+
+    /* a busy plugin is owned by its worker, resumed once it is done */
+    if (query_busy(plugin)) {
+        reactor_suspend(fd);
+        return;
+    }
+    if ((w->callback ? w->callback(plugin, fd, event, w->data)
+                     : plugin->update(plugin)) <= 0)
+        fd_redraw = 1;
+}
+
+int
+register_fd_callback(dl_plugin_t plugin, int fd, int event,
+                     dl_fd_callback_t callback, void *data) {
+    reactor_fn  fn;
+    void       *ctx;
+    fd_watch_s *w = (fd_watch_s *)malloc(sizeof(fd_watch_s));
+    if (!w) return -1;
+
+    w->plugin   = plugin->id;
+    w->callback = callback;
+    w->data     = data;
+
+    /* only a previous registration of the same plugin is replaced */
+    if (reactor_get(fd, &fn, &ctx) == 0) {
+        if (fn != &fd_dispatch || ((fd_watch_s *)ctx)->plugin != plugin->id) {
+            free(w);
+            return -1;
+        }
+        free(reactor_del(fd));
+    }
+    if (reactor_add(fd, event, &fd_dispatch, w)) {
+        free(w);
+        return -1;
+    }
+    return fd;
+}
 
 int
 register_update_fd(dl_plugin_t plugin, int fd, int event) {
-    if (fd_size == fd_alloc) {
-        fd_plugin = (int *)realloc(fd_plugin, sizeof(int) * (fd_alloc << 1));
-        fds       = (int *)realloc(fds, sizeof(int) * (fd_alloc << 1));
-        fd_flags  = (int *)realloc(fd_flags, sizeof(int) * (fd_alloc << 1));
-
-        if (!fd_plugin || !fds || !fd_flags) {
-            /* :( */
-            fprintf(stderr, "error when enlarge fd tables\n");
-            exit(EXIT_FAILURE);
+    return register_fd_callback(plugin, fd, event, NULL, NULL);
+}
+
+int
+unregister_update_fd(dl_plugin_t plugin, int id) {
+    reactor_fn fn;
+    void      *ctx;
+
+    /* the fd must be watched for this plugin */
+    if (reactor_get(id, &fn, &ctx) || fn != &fd_dispatch ||
+        ((fd_watch_s *)ctx)->plugin != plugin->id)
+        return -1;
+    free(reactor_del(id));
+    return 0;
+}
+
+static void
+print_stats(FILE *out) {
+    unsigned long hit, miss;
+
+    stats_print(out, &stats_show);
+    stats_print(out, &stats_grab);
+    if (stats_key.count) stats_print(out, &stats_key);
+    textw_stats(&hit, &miss);
+    fprintf(out, "textw cache: hit %lu miss %lu\n", hit, miss);
+    fprintf(out, "match kernel: %s\n", match_kernel());
+}
+
+static void
+signal_dispatch(int fd, int event, void *ctx) {
+    int signo;
+#ifdef __linux__
+    struct signalfd_siginfo si;
+    while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+        signo = si.ssi_signo;
+        if (signo == SIGUSR1) signal_time = stats_now();
+#else
+    unsigned char c;
+    while (read(fd, &c, 1) == 1) {
+        signo = c;
+#endif
+        if (signo == SIGUSR1)
+            show();
+        else if (signo == SIGUSR2)
+            print_stats(stderr);
+    }
+}
+
+/* a timer of a plugin, the id is its timerfd */
+typedef struct timer_watch_s {
+    int                 plugin;
+    int                 flags;
+    dl_timer_callback_t callback;
+    void               *data;
+} timer_watch_s;
+
+static void
+timer_dispatch(int fd, int event, void *ctx) {
+    timer_watch_s *t = (timer_watch_s *)ctx;
+    dl_plugin_t plugin = plugin_entry[t->plugin];
+    uint64_t expired;
+
+    /* held back until the worker is done or the window is hidden, the
+     * expiration stays readable meanwhile */
+    if (query_busy(plugin) || ((t->flags & DL_TIMER_IDLE) && showed)) {
+        reactor_suspend(fd);
+        return;
+    }
+    if (read(fd, &expired, sizeof(expired)) != sizeof(expired)) return;
+    if (t->callback(plugin, t->data) <= 0)
+        fd_redraw = 1;
+}
+
+int
+register_timer(dl_plugin_t plugin, int delay_ms, int interval_ms, int flags,
+               dl_timer_callback_t callback, void *data) {
+#ifdef __linux__
+    struct itimerspec its;
+    timer_watch_s *t = (timer_watch_s *)malloc(sizeof(timer_watch_s));
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (!t || fd < 0) goto failed;
+
+    t->plugin   = plugin->id;
+    t->flags    = flags;
+    t->callback = callback;
+    t->data     = data;
+
+    /* a zero value would disarm the timer */
+    its.it_value.tv_sec     = delay_ms / 1000;
+    its.it_value.tv_nsec    = (delay_ms % 1000) * 1000000L + (delay_ms == 0);
+    its.it_interval.tv_sec  = interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    if (timerfd_settime(fd, 0, &its, NULL) ||
+        reactor_add(fd, REACTOR_READ, &timer_dispatch, t))
+        goto failed;
+    return fd;
+
+  failed:
+    free(t);
+    if (fd >= 0) close(fd);
+#endif
+    return -1;
+}
+
+int
+unregister_timer(dl_plugin_t plugin, int id) {
+    reactor_fn fn;
+    void      *ctx;
+
+    /* the timer must be one of this plugin */
+    if (reactor_get(id, &fn, &ctx) || fn != &timer_dispatch ||
+        ((timer_watch_s *)ctx)->plugin != plugin->id)
+        return -1;
+    free(reactor_del(id));
+    close(id);
+    return 0;
+}
+
+/* a client of the control socket */
+typedef struct control_conn_s {
+    size_t len;
+    char   line[CONTROL_LINE_MAX];
+} control_conn_s;
+
+void
+control_init(char *argv[]) {
+    /* the socket survives a reload */
+    const char *inherited = getenv("DLAUNCHER_CONTROL_FD");
+
+    control_argv = argv;
+    if (inherited) {
+        control_fd = atoi(inherited);
+        unsetenv("DLAUNCHER_CONTROL_FD");
+        fcntl(control_fd, F_SETFD, FD_CLOEXEC);
+    } else control_fd = control_listen();
+
+    if (control_fd < 0)
+        eprintf("cannot listen on the control socket, already running?\n");
+}
+
+static void
+control_reload(void) {
+    char buf[32];
+    int p;
+
+    if (showed) hide();
+    if (dc->dpy) XSync(dc->dpy, False);
+
+    /* the plugins run by this image see their input closed and quit,
+     * the new one starts its own */
+    for (p = 0; p < plugin_count; ++ p)
+        external_plugin_close(plugin_entry[p]);
+
+    snprintf(buf, sizeof(buf), "%d", control_fd);
+    setenv("DLAUNCHER_CONTROL_FD", buf, 1);
+    fcntl(control_fd, F_SETFD, 0);
+#ifdef __linux__
+    execv("/proc/self/exe", control_argv);
+#endif
+    execvp(control_argv[0], control_argv);
+
+    fcntl(control_fd, F_SETFD, FD_CLOEXEC);
+    unsetenv("DLAUNCHER_CONTROL_FD");
+    fprintf(stderr, "cannot reload\n");
+}
+
+/* show the window, with the input and the plugin if given */
+static int
+control_open(const char *input, const char *plugin) {
+    int p;
+
+    if (plugin) {
+        for (p = 0; p < plugin_count; ++ p)
+            if (!strcmp(plugin_entry[p]->name, plugin)) break;
+        if (p == plugin_count) return -1;
+        cur_plugin = plugin_entry[p];
+    }
+    if (input) {
+        strncpy(text, input, sizeof text - 1);
+        text[sizeof text - 1] = 0;
+        cursor = strlen(text);
+    }
+
+    if (showed) update(1);
+    else {
+        signal_time = stats_now();
+        show();
+    }
+    return 0;
+}
+
+static void
+control_command(int fd, char *line) {
+    char *arg = strchr(line, ' ');
+    const char *error = NULL;
+
+    if (arg) *(arg ++) = 0;
+
+    if (!strcmp(line, "open")) {
+        control_open(NULL, NULL);
+    } else if (!strcmp(line, "open-text")) {
+        control_open(arg ? arg : "", NULL);
+    } else if (!strcmp(line, "open-plugin") && arg) {
+        char *input = strchr(arg, ' ');
+        if (input) *(input ++) = 0;
+        if (control_open(input, arg)) error = "no such plugin";
+    } else if (!strcmp(line, "stats")) {
+        FILE *out = fdopen(dup(fd), "w");
+        if (out) {
+            print_stats(out);
+            fclose(out);
+        }
+    } else if (!strcmp(line, "reload")) {
+        dprintf(fd, "ok\n");
+        close(fd);
+        control_reload();
+        return;
+    } else if (!strcmp(line, "quit")) {
+        char path[BUFSIZ];
+        dprintf(fd, "ok\n");
+        close(fd);
+        if (control_path(path, sizeof(path)) == 0) unlink(path);
+        exit(EXIT_SUCCESS);
+    } else error = "unknown command";
+
+    if (error) dprintf(fd, "error %s\n", error);
+    else dprintf(fd, "ok\n");
+    close(fd);
+}
+
+static void
+control_read(int fd, int event, void *ctx) {
+    control_conn_s *c = (control_conn_s *)ctx;
+    ssize_t r = read(fd, c->line + c->len, sizeof(c->line) - 1 - c->len);
+    char *nl;
+
+    if (r < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (r > 0) c->len += r;
+    c->line[c->len] = 0;
+
+    nl = strchr(c->line, '\n');
+    /* wait for the whole line, unless the client is done */
+    if (!nl && r > 0 && c->len < sizeof(c->line) - 1) return;
+
+    reactor_del(fd);
+    if (nl) *nl = 0;
+    if (r < 0 || c->len == 0) close(fd);
+    else control_command(fd, c->line);
+    free(c);
+}
+
+static void
+control_accept(int fd, int event, void *ctx) {
+    int c;
+
+    while ((c = accept(fd, NULL, NULL)) >= 0) {
+        control_conn_s *conn = (control_conn_s *)malloc(sizeof(control_conn_s));
+        fcntl(c, F_SETFD, FD_CLOEXEC);
+        fcntl(c, F_SETFL, O_NONBLOCK);
+        if (conn) conn->len = 0;
+        if (!conn || reactor_add(c, REACTOR_READ, &control_read, conn)) {
+            free(conn);
+            close(c);
         }
+    }
+}
+
+static void
+x11_dispatch(int fd, int event, void *ctx) {
+    /* events are read by the loop in run() */
+}
+
+static void
+query_dispatch(int fd, int event, void *ctx) {
+    if (query_collect()) {
+        /* fds of the plugins done are watched again */
+        reactor_resume_all();
+        fd_redraw = 1;
+    }
+}
+
+/* one round of the main loop once the keys are handled: let the idle
+ * plugins prepare, then call back the ready fds */
+static void
+dispatch(int timeout_ms) {
+    int i;
 
-        fd_alloc <<= 1;
+    open_flush();
+    for (i = 0; i < plugin_count; ++ i) {
+        /* a busy plugin is owned by its worker */
+        if (query_busy(plugin_entry[i])) continue;
+        if (plugin_entry[i]->before_update)
+            plugin_entry[i]->before_update(plugin_entry[i]);
     }
 
-    int id = fd_size ++;
+    /* nothing flushes the frame of the last keys while blocked, and
+     * events read in by the flush are not seen by the reactor */
+    if (dc->dpy) {
+        XFlush(dc->dpy);
+        if (XEventsQueued(dc->dpy, QueuedAlready)) timeout_ms = 0;
+    }
+
+    fd_redraw = 0;
+    reactor_wait(timeout_ms);
+
+    if (showed && fd_redraw) {
+        update(0);
+    }
+}
+
+/* headless mode reads commands from stdin, one per line:
+ *
+ *   type text                 type the characters of text, a key each
+ *   key [C-][M-][S-]keysym    press a key, e.g. "key Down" or "key C-n"
+ *   wait                      wait for all the queries and redraw
+ *   show                      show the menu again, e.g. after a Return
+ *   dump file                 write the canvas to file as a PPM image
+ *   stats                     print the stats to stdout
+ *
+ * Each key is timed from its handling to its frame, query round
+ * included, into stats_key.
+ */
+
+static void
+headless_key(KeySym ksym, unsigned int state, char *buf, int len) {
+    double start = stats_now();
+
+    keysym_press(ksym, state, buf, len);
+    flush_query();
+    stats_add(&stats_key, stats_now() - start);
+}
 
-    fd_plugin[id] = plugin->id;
-    fds[id] = fd;
-    fd_flags[id] = event;
+static void
+headless_command(char *line) {
+    char *arg = strchr(line, ' ');
+    char buf[8];
+
+    if (arg) *(arg ++) = 0;
+
+    if (!strcmp(line, "type") && arg) {
+        while (*arg) {
+            int len = 1;
+            while (arg[len] && ((unsigned char)arg[len] & 0xC0) == 0x80) ++ len;
+            memcpy(buf, arg, len);
+            buf[len] = 0;
+            headless_key(NoSymbol, 0, buf, len);
+            arg += len;
+        }
+    } else if (!strcmp(line, "key") && arg) {
+        unsigned int state = 0;
+        KeySym ksym;
+        for (;; arg += 2) {
+            if      (!strncmp(arg, "C-", 2)) state |= ControlMask;
+            else if (!strncmp(arg, "M-", 2)) state |= Mod1Mask;
+            else if (!strncmp(arg, "S-", 2)) state |= ShiftMask;
+            else break;
+        }
+        if ((ksym = XStringToKeysym(arg)) == NoSymbol) {
+            fprintf(stderr, "unknown keysym %s\n", arg);
+            return;
+        }
+        /* a single character names itself */
+        buf[0] = strlen(arg) == 1 ? *arg : 0;
+        headless_key(ksym, state, buf, buf[0] ? 1 : 0);
+    } else if (!strcmp(line, "wait")) {
+        query_wait(-1);
+        query_collect();
+        reactor_resume_all();
+        open_flush();
+        if (showed) update(0);
+    } else if (!strcmp(line, "show")) {
+        if (!showed) show();
+    } else if (!strcmp(line, "dump") && arg) {
+        if (writedc(dc, arg))
+            fprintf(stderr, "cannot write %s\n", arg);
+    } else if (!strcmp(line, "stats")) {
+        print_stats(stdout);
+        fflush(stdout);
+    } else if (*line) {
+        fprintf(stderr, "unknown command %s\n", line);
+    }
+}
 
-    if (max_fd < fd) max_fd = fd;
-    if (event & DL_FD_EVENT_READ)
-        FD_SET(fd, &in_fds);
-    if (event & DL_FD_EVENT_WRITE)
-        FD_SET(fd, &out_fds);
-    if (event & DL_FD_EVENT_STATUS)
-        FD_SET(fd, &stat_fds);
+/* stdin may be a regular file, which cannot be watched, so commands are
+ * read in turns with polling the reactor */
+static void
+headless_run(void) {
+    char line[CONTROL_LINE_MAX];
 
-    return id;
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\n")] = 0;
+        dispatch(0);
+        headless_command(line);
+    }
+    query_wait(-1);
+    open_flush();
+    exit(EXIT_SUCCESS);
 }
 
 void
 run(void) {
     XEvent ev;
-    int x11_fd = ConnectionNumber(dc->dpy);
-    int i;
-    struct timeval tv;
 
-    fd_alloc = NPLUGIN;
-    fd_size  = 0;
-    fd_plugin= (int *)malloc(sizeof(int) * fd_alloc);
-    fds      = (int *)malloc(sizeof(int) * fd_alloc);
-    fd_flags = (int *)malloc(sizeof(int) * fd_alloc);
+    if (reactor_add(query_notify_fd(), REACTOR_READ, &query_dispatch, NULL) ||
+        reactor_add(signal_fd, REACTOR_READ, &signal_dispatch, NULL))
+        eprintf("cannot watch fds\n");
 
-    if (!fd_plugin || !fds || !fd_flags) return;
+    if (headless) headless_run();
 
-    while(1) {
-        if (to_show) {
-            to_show = 0;
-            show();
-        }
+    if (reactor_add(ConnectionNumber(dc->dpy), REACTOR_READ, &x11_dispatch, NULL) ||
+        reactor_add(control_fd, REACTOR_READ, &control_accept, NULL))
+        eprintf("cannot watch the display and the control socket\n");
 
+    while(1) {
         while (XPending(dc->dpy)) {
             XNextEvent(dc->dpy, &ev);
             if(XFilterEvent(&ev, win))
@@ -1106,92 +2456,108 @@ run(void) {
                 if(ev.xvisibility.state != VisibilityUnobscured)
                     XRaiseWindow(dc->dpy, win);
                 break;
+            case ConfigureNotify:
+                if(ev.xconfigure.window == DefaultRootWindow(dc->dpy))
+                    geo_invalidate();
+                break;
+            default:
+#ifdef XRANDR
+                if(ev.type == randr_event + RRScreenChangeNotify) {
+                    XRRUpdateConfiguration(&ev);
+                    geo_invalidate();
+                }
+#endif
+                break;
             }
         }
+        /* one query round for all the keys typed meanwhile */
+        flush_query();
+        dispatch(-1);
+    }
+}
 
-        FD_ZERO(&in_fds); FD_ZERO(&out_fds); FD_ZERO(&stat_fds);
-        FD_SET(x11_fd, &in_fds);
-        max_fd = x11_fd;
-
-        tv.tv_usec = 0;
-        tv.tv_sec = 3;
-
-        fd_size = 0;
-        for (i = 0; i < plugin_count; ++ i) {
-            plugin_update[i] = 0;
-            if (plugin_entry[i]->before_update)
-                plugin_entry[i]->before_update(plugin_entry[i]);
-        }
-
-        select(max_fd + 1, &in_fds, &out_fds, &stat_fds, &tv);
-
-        for (i = 0; i < fd_size; ++ i) {
-            if ((fd_flags[i] & DL_FD_EVENT_READ) &&
-                FD_ISSET(fds[i], &in_fds))
-                plugin_update[fd_plugin[i]] = 1;
-            else if ((fd_flags[i] & DL_FD_EVENT_WRITE) &&
-                     FD_ISSET(fds[i], &out_fds))
-                plugin_update[fd_plugin[i]] = 1;
-            else if ((fd_flags[i] & DL_FD_EVENT_STATUS) &&
-                     FD_ISSET(fds[i], &stat_fds))
-                plugin_update[fd_plugin[i]] = 1;
-        }
-
-        int to_update = 0;
-        for (i = 0; i < plugin_count; ++ i) {
-            if (plugin_update[i]) {
-                plugin_entry[i]->update(plugin_entry[i]);
-                to_update = 1;
-            }
-        }
+#ifdef XINERAMA
+/* screen layout, queried again only once the screens changed */
+static XineramaScreenInfo *geo_info;
+static int                 geo_count;
+static int                 geo_valid;
+#endif
 
-        if (showed && to_update) {
-            update(0);
-        }
+/* the screens were reconfigured */
+static void
+geo_invalidate(void) {
+#ifdef XINERAMA
+    geo_valid = 0;
+#endif
+}
 
+/* top-level window being used, as told by the window manager, or else
+ * the window having the input focus */
+static Window
+active_window(Window root) {
+    Atom type;
+    int format, di;
+    unsigned long n, left;
+    unsigned char *p = NULL;
+    Window w = None;
+
+    if (XGetWindowProperty(dc->dpy, root, net_active, 0, 1, False, XA_WINDOW,
+                           &type, &format, &n, &left, &p) == Success && p) {
+        if (type == XA_WINDOW && format == 32 && n == 1)
+            w = *(Window *)p;
+        XFree(p);
     }
+    if (w == None)
+        XGetInputFocus(dc->dpy, &w, &di);
+    return w;
 }
 
 void
 calc_geo(void) {
+    if (headless) {
+        mx = my = 0;
+        mw = HEADLESS_WIDTH;
+        return;
+    }
+
     int x, y, screen = DefaultScreen(dc->dpy);
     Window root = RootWindow(dc->dpy, screen);
 
 #ifdef XINERAMA
-    int n;
-    XineramaScreenInfo *info;
+    if (!geo_valid) {
+        if (geo_info) XFree(geo_info);
+        geo_info = XineramaQueryScreens(dc->dpy, &geo_count);
+        geo_valid = 1;
+    }
 
-    if((info = XineramaQueryScreens(dc->dpy, &n))) {
+    if(geo_info) {
+        XineramaScreenInfo *info = geo_info;
+        int n = geo_count;
         int a, j, di, i = 0, area = 0;
-        unsigned int du;
-        Window w, pw, dw, *dws;
-        XWindowAttributes wa;
-
-        XGetInputFocus(dc->dpy, &w, &di);
-        if(w != root && w != PointerRoot && w != None) {
-            /* find top-level window containing current input focus */
-            do {
-                if(XQueryTree(dc->dpy, (pw = w), &dw, &w, &dws, &du) && dws)
-                    XFree(dws);
-            } while(w != root && w != pw);
+        unsigned int w, h, du;
+        Window aw, dw;
+
+        /* a constant number of round trips, however deep the window is */
+        aw = active_window(root);
+        if(aw != root && aw != PointerRoot && aw != None &&
+           XGetGeometry(dc->dpy, aw, &dw, &x, &y, &w, &h, &du, &du) &&
+           XTranslateCoordinates(dc->dpy, aw, root, 0, 0, &x, &y, &dw)) {
             /* find xinerama screen with which the window intersects most */
-            if(XGetWindowAttributes(dc->dpy, pw, &wa))
-                for(j = 0; j < n; j++)
-                    if((a = INTERSECT(wa.x, wa.y, wa.width, wa.height, info[j])) > area) {
-                        area = a;
-                        i = j;
-                    }
+            for(j = 0; j < n; j++)
+                if((a = INTERSECT(x, y, (int)w, (int)h, info[j])) > area) {
+                    area = a;
+                    i = j;
+                }
         }
         /* no focused window is on screen, so use pointer location instead */
         if(!area && XQueryPointer(dc->dpy, root, &dw, &dw, &x, &y, &di, &di, &du))
-            for(i = 0; i < n; i++)
+            for(i = 0; i < n - 1; i++)
                 if(INTERSECT(x, y, 1, 1, info[i]))
                     break;
 
         mx = info[i].x_org;
         my = info[i].y_org + (topbar ? 0 : info[i].height - mh);
         mw = info[i].width;
-        XFree(info);
     }
     else
 #endif
@@ -1204,21 +2570,37 @@ calc_geo(void) {
 
 void
 setup(void) {
-    int screen = DefaultScreen(dc->dpy);
-    Window root = RootWindow(dc->dpy, screen);
     XSetWindowAttributes swa;
     XIM xim;
 
-    clip = XInternAtom(dc->dpy, "CLIPBOARD",   False);
-    utf8 = XInternAtom(dc->dpy, "UTF8_STRING", False);
-
     /* calculate menu geometry */
     bh = dc->font.height + 2;
     lines = MAX(lines, 0);
     mh = (lines + 1) * bh;
 
+    if (headless) {
+        calc_geo();
+        return;
+    }
+
+    int screen = DefaultScreen(dc->dpy);
+    Window root = RootWindow(dc->dpy, screen);
+
+    net_active = XInternAtom(dc->dpy, "_NET_ACTIVE_WINDOW", False);
     calc_geo();
 
+    clip = XInternAtom(dc->dpy, "CLIPBOARD",   False);
+    utf8 = XInternAtom(dc->dpy, "UTF8_STRING", False);
+
+    /* screen changes drop the cached layout, see calc_geo() */
+    XSelectInput(dc->dpy, root, StructureNotifyMask);
+#ifdef XRANDR
+    int di;
+    if (!XRRQueryExtension(dc->dpy, &randr_event, &di))
+        randr_event = -1;
+    else XRRSelectInput(dc->dpy, root, RRScreenChangeNotifyMask);
+#endif
+
     /* create menu window */
     swa.override_redirect = True;
     swa.background_pixel = normcol->BG;
@@ -1259,22 +2641,68 @@ plugin_cycle_prev(void) {
     update(0);
 }
 
+#ifndef __linux__
+static void
+signal_handler(int signo) {
+    int e = errno;
+    unsigned char c = signo;
+    if (signo == SIGUSR1) signal_time = stats_now();
+    if (write(signal_pipe[1], &c, 1) < 0) { /* full, already woken */ }
+    errno = e;
+}
+#endif
+
 void
-signal_show(int signo) {
-    to_show = 1;
+signal_init(void) {
+#ifdef __linux__
+    sigset_t set;
+
+    /* blocked before any thread starts, so that every thread keeps it
+     * blocked and the signals are only read from the fd */
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    if (sigprocmask(SIG_BLOCK, &set, NULL) ||
+        (signal_fd = signalfd(-1, &set, SFD_CLOEXEC | SFD_NONBLOCK)) < 0)
+        eprintf("cannot create signalfd\n");
+#else
+    /* self-pipe */
+    int i;
+    if (pipe(signal_pipe))
+        eprintf("cannot create signal pipe\n");
+    for (i = 0; i < 2; ++ i) {
+        fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(signal_pipe[i], F_SETFL, O_NONBLOCK);
+    }
+    signal_fd = signal_pipe[0];
+    signal(SIGUSR1, signal_handler);
+    signal(SIGUSR2, signal_handler);
+#endif
 }
 
 void
 show(void) {
-    grabkeyboard();
     calc_geo();
-    XMoveWindow(dc->dpy, win, mx, my);
-    XResizeWindow(dc->dpy, win, mw, mh);
-    XMapRaised(dc->dpy, win);
+    if (!headless) {
+        XMoveWindow(dc->dpy, win, mx, my);
+        XResizeWindow(dc->dpy, win, mw, mh);
+        XMapRaised(dc->dpy, win);
+        /* before the query, whose deadline would leave the first keys
+         * to the focused client; only the first try waits for the
+         * server, retries run from the reactor while the query runs */
+        grabkeyboard();
+    }
     resizedc(dc, mw, mh);
     update(1);
 
     showed = 1;
+
+    /* the first frame is on the screen once the server processed it */
+    if (signal_time > 0) {
+        if (dc->dpy) XSync(dc->dpy, False);
+        stats_add(&stats_show, stats_now() - signal_time);
+        signal_time = 0;
+    }
 }
 
 void
@@ -1286,15 +2714,21 @@ hide(void) {
     hist_index = -1;
     showed = 0;
 
-    XUnmapWindow(dc->dpy, win);
-    XUngrabKeyboard(dc->dpy, CurrentTime);
+    if (!headless) {
+        grab_cancel();
+        XUnmapWindow(dc->dpy, win);
+        XUngrabKeyboard(dc->dpy, CurrentTime);
+    }
+
+    /* idle timers held back while shown */
+    reactor_resume_all();
 }
 
 void
 usage(void) {
-    fputs("usage: dlauncher [-b] [-i] [-l lines] [-fn font]\n"
+    fputs("usage: dlauncher [-b] [-i] [-headless] [-l lines] [-fn font]\n"
           "                 [-nb color] [-nf color] [-sb color] [-sf color] [-v]\n"
-          "                 [-args external_args_file]*\n"
+          "                 [-history file] [-args external_args_file]*\n"
           "                 [-pl name:entry[:opt]]*\n"
           , stderr);
     exit(EXIT_FAILURE);
@@ -10,8 +10,76 @@
 #define MAX(a, b)  ((a) > (b) ? (a) : (b))
 #define MIN(a, b)  ((a) < (b) ? (a) : (b))
 
+/* direct-mapped cache of the widths measured by textw(), keyed by the
+ * content of the string and the font */
+#define WCACHE_SIZE 1024
+#define WCACHE_MAX  256   /* longer strings are not cached */
+
+typedef struct {
+	unsigned int hash;
+	const void *font;
+	size_t len;
+	int width;
+	char text[WCACHE_MAX];
+} WidthEntry;
+
+static WidthEntry *wcache;
+static unsigned long wcache_hit, wcache_miss;
+
+static unsigned int
+wcache_hash(const char *text, size_t len) {
+	unsigned int h = 2166136261u;   /* FNV-1a */
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		h = (h ^ (unsigned char)text[i]) * 16777619u;
+	return h;
+}
+
+static const void *
+wcache_font(DC *dc) {
+	if(dc->font.xft_font)
+		return dc->font.xft_font;
+	if(dc->font.set)
+		return dc->font.set;
+	return dc->font.xfont;
+}
+
+static void
+wcache_flush(void) {
+	free(wcache);
+	wcache = NULL;
+}
+
+/* in-memory canvas, used when there is no display */
+static void
+imagefill(DC *dc, int x, int y, int w, int h, unsigned long color) {
+	int i, j;
+
+	w = MIN(x + w, dc->canvas_w) - MAX(x, 0);
+	h = MIN(y + h, dc->canvas_h) - MAX(y, 0);
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+	for(j = 0; j < h; j++)
+		for(i = 0; i < w; i++)
+			dc->image[(y + j) * dc->canvas_w + x + i] = color;
+}
+
 void
 drawrect(DC *dc, int x, int y, unsigned int w, unsigned int h, Bool fill, unsigned long color) {
+	if(!dc->dpy) {
+		x += dc->x;
+		y += dc->y;
+		if(fill) {
+			imagefill(dc, x, y, w, h, color);
+		} else {
+			imagefill(dc, x, y, w, 1, color);
+			imagefill(dc, x, y + h - 1, w, 1, color);
+			imagefill(dc, x, y, 1, h, color);
+			imagefill(dc, x + w - 1, y, 1, h, color);
+		}
+		return;
+	}
 	XSetForeground(dc->dpy, dc->gc, color);
 	if(fill)
 		XFillRectangle(dc->dpy, dc->canvas, dc->gc, dc->x + x, dc->y + y, w, h);
@@ -19,28 +87,86 @@ drawrect(DC *dc, int x, int y, unsigned int w, unsigned int h, Bool fill, unsign
 		XDrawRectangle(dc->dpy, dc->canvas, dc->gc, dc->x + x, dc->y + y, w-1, h-1);
 }
 
+/* start of the UTF-8 character containing byte [i] */
+static size_t
+utf8_back(const char *s, size_t i) {
+	while(i > 0 && ((unsigned char)s[i] & 0xC0) == 0x80)
+		i--;
+	return i;
+}
+
+/* end of the UTF-8 character starting at byte [i] */
+static size_t
+utf8_next(const char *s, size_t i, size_t n) {
+	for(i++; i < n && ((unsigned char)s[i] & 0xC0) == 0x80; i++);
+	return i;
+}
+
+/* length of the longest prefix of [text] ending on a character boundary
+ * and no wider than [w], [n] must be a boundary too; binary search so
+ * that the number of extent requests is logarithmic in [n] */
+static size_t
+fitprefix(DC *dc, const char *text, size_t n, int w) {
+	size_t lo = 0, hi = n, mid;
+
+	while(lo < hi) {
+		mid = utf8_back(text, lo + (hi - lo + 1) / 2);
+		if(mid <= lo)
+			mid = utf8_next(text, lo, hi);
+		if(textnw(dc, text, mid) <= w)
+			lo = mid;
+		else
+			hi = utf8_back(text, mid - 1);
+	}
+	return lo;
+}
+
+#define ELLIPSIS "..."
+
 void
 drawtext(DC *dc, const char *text, ColorSet *col) {
 	char buf[BUFSIZ];
+	int dots, ew, w = dc->w - dc->font.height/2;
 	size_t mn, n = strlen(text);
 
-	/* shorten text if necessary */
-	for(mn = MIN(n, sizeof buf); textnw(dc, text, mn) + dc->font.height/2 > dc->w; mn--)
-		if(mn == 0)
-			return;
-	memcpy(buf, text, mn);
-	if(mn < n)
-		for(n = MAX(mn-3, 0); n < mn; buf[n++] = '.');
+	/* shorten text if necessary, ending it by an ellipsis if there is room */
+	if(n < sizeof buf && textnw(dc, text, n) <= w) {
+		mn = n;
+	} else {
+		n = utf8_back(text, MIN(n, sizeof buf - sizeof ELLIPSIS));
+		ew = textnw(dc, ELLIPSIS, sizeof ELLIPSIS - 1);
+		dots = ew <= w;
+		mn = fitprefix(dc, text, n, dots ? w - ew : w);
+		memcpy(buf, text, mn);
+		if(dots) {
+			memcpy(buf + mn, ELLIPSIS, sizeof ELLIPSIS - 1);
+			mn += sizeof ELLIPSIS - 1;
+		}
+		text = buf;
+	}
 
 	drawrect(dc, 0, 0, dc->w, dc->h, True, col->BG);
-	drawtextn(dc, buf, mn, col);
+	if(mn > 0)
+		drawtextn(dc, text, mn, col);
 }
 
 void
 drawtextn(DC *dc, const char *text, size_t n, ColorSet *col) {
 	int x = dc->x + dc->font.height/2;
 	int y = dc->y + dc->font.ascent+1;
+	size_t i;
 
+	if(!dc->dpy) {
+		/* a glyph is a block of the advance of the font */
+		for(i = 0; i < n; i++) {
+			if(((unsigned char)text[i] & 0xC0) == 0x80)
+				continue;
+			if(text[i] != ' ')
+				imagefill(dc, x + 1, y - dc->font.ascent + 2, dc->font.width - 2, dc->font.ascent - 2, col->FG);
+			x += dc->font.width;
+		}
+		return;
+	}
 	XSetForeground(dc->dpy, dc->gc, col->FG);
 	if(dc->font.xft_font) {
 		if (!dc->xftdraw)
@@ -73,7 +199,7 @@ eprintf(const char *fmt, ...) {
 void
 freecol(DC *dc, ColorSet *col) {
     if(col) {
-        if(&col->FG_xft)
+        if(dc->dpy && dc->font.xft_font)
             XftColorFree(dc->dpy, DefaultVisual(dc->dpy, DefaultScreen(dc->dpy)),
                 DefaultColormap(dc->dpy, DefaultScreen(dc->dpy)), &col->FG_xft);
         free(col); 
@@ -82,6 +208,8 @@ freecol(DC *dc, ColorSet *col) {
 
 void
 freedc(DC *dc) {
+    wcache_flush();
+    free(dc->image);
     if(dc->font.xft_font) {
         XftFontClose(dc->dpy, dc->font.xft_font);
         XftDrawDestroy(dc->xftdraw);
@@ -90,7 +218,7 @@ freedc(DC *dc) {
 		XFreeFontSet(dc->dpy, dc->font.set);
     if(dc->font.xfont)
 		XFreeFont(dc->dpy, dc->font.xfont);
-    if(dc->canvas)
+    if(dc->dpy && dc->canvas)
 		XFreePixmap(dc->dpy, dc->canvas);
 	if(dc->gc)
         XFreeGC(dc->dpy, dc->gc);
@@ -102,6 +230,15 @@ freedc(DC *dc) {
 
 unsigned long
 getcolor(DC *dc, const char *colstr) {
+	unsigned int r, g, b;
+
+	if(!dc->dpy) {
+		/* only #rrggbb without a display, as 0xrrggbb */
+		if(sscanf(colstr, "#%2x%2x%2x", &r, &g, &b) != 3 || strlen(colstr) != 7)
+			eprintf("cannot allocate color '%s' without a display\n", colstr);
+		return (r << 16) | (g << 8) | b;
+	}
+
 	Colormap cmap = DefaultColormap(dc->dpy, DefaultScreen(dc->dpy));
 	XColor color;
 
@@ -117,7 +254,7 @@ initcolor(DC *dc, const char * foreground, const char * background) {
 		eprintf("error, cannot allocate memory for color set");
 	col->BG = getcolor(dc, background);
 	col->FG = getcolor(dc, foreground);
-	if(dc->font.xft_font)
+	if(dc->dpy && dc->font.xft_font)
 		if(!XftColorAllocName(dc->dpy, DefaultVisual(dc->dpy, DefaultScreen(dc->dpy)),
                               DefaultColormap(dc->dpy, DefaultScreen(dc->dpy)), foreground,
                               &col->FG_xft))
@@ -141,12 +278,44 @@ initdc(void) {
 	return dc;
 }
 
+/* headless draw context
+ *
+ * Rendering goes to the pixmap if a display is reachable (e.g. Xvfb),
+ * with the real fonts, but no window is ever mapped. Otherwise it goes
+ * to an in-memory image of 0xrrggbb pixels, with a fixed-advance font
+ * whose size is taken from the font name ("Monospace-11").
+ */
+DC *
+initdc_headless(void) {
+	DC *dc;
+
+	setlocale(LC_CTYPE, "");
+	if(!(dc = calloc(1, sizeof *dc)))
+		eprintf("cannot malloc %u bytes:", sizeof *dc);
+	if((dc->dpy = XOpenDisplay(NULL))) {
+		dc->gc = XCreateGC(dc->dpy, DefaultRootWindow(dc->dpy), 0, NULL);
+		XSetLineAttributes(dc->dpy, dc->gc, 1, LineSolid, CapButt, JoinMiter);
+	}
+	return dc;
+}
+
 void
 initfont(DC *dc, const char *fontstr) {
 	char *def, **missing, **names;
 	int i, n;
 	XFontStruct **xfonts;
 
+	/* a font loaded later may reuse the address of a freed one */
+	wcache_flush();
+	if(!dc->dpy) {
+		const char *size = strrchr(fontstr, '-');
+		int px = (size && atoi(size + 1) > 0) ? atoi(size + 1) * 4 / 3 : 15;
+		dc->font.ascent = px * 4 / 5;
+		dc->font.descent = px - dc->font.ascent;
+		dc->font.width = MAX(px * 3 / 5, 3);
+		dc->font.height = px;
+		return;
+	}
 	missing = NULL;
 	if((dc->font.xfont = XLoadQueryFont(dc->dpy, fontstr))) {
 		dc->font.ascent = dc->font.xfont->ascent;
@@ -174,17 +343,36 @@ initfont(DC *dc, const char *fontstr) {
 
 void
 mapdc(DC *dc, Window win, unsigned int w, unsigned int h) {
-	XCopyArea(dc->dpy, dc->canvas, win, dc->gc, 0, 0, w, h, 0, 0);
+	mapdcrect(dc, win, 0, 0, w, h);
+}
+
+void
+mapdcrect(DC *dc, Window win, int x, int y, unsigned int w, unsigned int h) {
+	if(!dc->dpy || win == None)
+		return;
+	XCopyArea(dc->dpy, dc->canvas, win, dc->gc, x, y, w, h, x, y);
 }
 
 void
 resizedc(DC *dc, unsigned int w, unsigned int h) {
+	if(!dc->dpy) {
+		unsigned long *image = realloc(dc->image, sizeof *image * w * h);
+		if(!image)
+			eprintf("cannot malloc %u bytes:", sizeof *image * w * h);
+		dc->image = image;
+		dc->w = dc->canvas_w = w;
+		dc->h = dc->canvas_h = h;
+		/* a new canvas, as a new pixmap would be */
+		dc->canvas++;
+		return;
+	}
+
 	int screen = DefaultScreen(dc->dpy);
 	if(dc->canvas)
 		XFreePixmap(dc->dpy, dc->canvas);
 
-	dc->w = w;
-	dc->h = h;
+	dc->w = dc->canvas_w = w;
+	dc->h = dc->canvas_h = h;
 	dc->canvas = XCreatePixmap(dc->dpy, DefaultRootWindow(dc->dpy), w, h,
 	                           DefaultDepth(dc->dpy, screen));
 	if (dc->font.xft_font) {
@@ -198,7 +386,14 @@ resizedc(DC *dc, unsigned int w, unsigned int h) {
 
 int
 textnw(DC *dc, const char *text, size_t len) {
-	if(dc->font.xft_font) {
+	if(!dc->dpy) {
+		int n = 0;
+		size_t i;
+		for(i = 0; i < len; i++)
+			if(((unsigned char)text[i] & 0xC0) != 0x80)
+				n++;
+		return n * dc->font.width;
+	} else if(dc->font.xft_font) {
 		XGlyphInfo gi;
 		XftTextExtentsUtf8(dc->dpy, dc->font.xft_font, (const FcChar8*)text, len, &gi);
 		return gi.width;
@@ -212,5 +407,80 @@ textnw(DC *dc, const char *text, size_t len) {
 
 int
 textw(DC *dc, const char *text) {
-	return textnw(dc, text, strlen(text)) + dc->font.height;
+	size_t len = strlen(text);
+	unsigned int hash;
+	const void *font;
+	WidthEntry *e;
+
+	if(len >= WCACHE_MAX)
+		return textnw(dc, text, len) + dc->font.height;
+	if(!wcache && !(wcache = calloc(WCACHE_SIZE, sizeof *wcache)))
+		return textnw(dc, text, len) + dc->font.height;
+
+	hash = wcache_hash(text, len);
+	font = wcache_font(dc);
+	e = &wcache[hash % WCACHE_SIZE];
+	if(e->font == font && e->hash == hash && e->len == len && !memcmp(e->text, text, len)) {
+		wcache_hit++;
+		return e->width + dc->font.height;
+	}
+
+	wcache_miss++;
+	e->hash = hash;
+	e->font = font;
+	e->len = len;
+	e->width = textnw(dc, text, len);
+	memcpy(e->text, text, len);
+	return e->width + dc->font.height;
+}
+
+void
+textw_stats(unsigned long *hit, unsigned long *miss) {
+	*hit = wcache_hit;
+	*miss = wcache_miss;
+}
+
+/* shift of the lowest bit of [mask] and its width */
+static void
+maskbits(unsigned long mask, int *shift, int *bits) {
+	for(*shift = 0; mask && !(mask & 1); mask >>= 1)
+		(*shift)++;
+	for(*bits = 0; mask & 1; mask >>= 1)
+		(*bits)++;
+}
+
+/* write the canvas as a binary PPM to [path] */
+int
+writedc(DC *dc, const char *path) {
+	XImage *img = NULL;
+	unsigned long masks[3] = { 0xff0000, 0x00ff00, 0x0000ff }, p;
+	int x, y, c, shift, bits;
+	FILE *f;
+
+	if(dc->dpy) {
+		Visual *vis = DefaultVisual(dc->dpy, DefaultScreen(dc->dpy));
+		masks[0] = vis->red_mask;
+		masks[1] = vis->green_mask;
+		masks[2] = vis->blue_mask;
+		if(!(img = XGetImage(dc->dpy, dc->canvas, 0, 0, dc->canvas_w, dc->canvas_h, AllPlanes, ZPixmap)))
+			return -1;
+	}
+	if(!(f = fopen(path, "wb"))) {
+		if(img)
+			XDestroyImage(img);
+		return -1;
+	}
+
+	fprintf(f, "P6\n%d %d\n255\n", dc->canvas_w, dc->canvas_h);
+	for(y = 0; y < dc->canvas_h; y++)
+		for(x = 0; x < dc->canvas_w; x++) {
+			p = img ? XGetPixel(img, x, y) : dc->image[y * dc->canvas_w + x];
+			for(c = 0; c < 3; c++) {
+				maskbits(masks[c], &shift, &bits);
+				fputc(bits ? (int)(((p & masks[c]) >> shift) * 255 / ((1UL << bits) - 1)) : 0, f);
+			}
+		}
+	if(img)
+		XDestroyImage(img);
+	return fclose(f) ? -1 : 0;
 }
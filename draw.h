@@ -8,7 +8,9 @@ typedef struct {
 	Display *dpy;
 	GC gc;
 	Pixmap canvas;
+	int canvas_w, canvas_h;
 	XftDraw *xftdraw;
+	unsigned long *image;  /* canvas when there is no display, see initdc_headless() */
 	struct {
 		int ascent;
 		int descent;
@@ -35,8 +37,12 @@ void freedc(DC *dc);
 unsigned long getcolor(DC *dc, const char *colstr);
 ColorSet *initcolor(DC *dc, const char *foreground, const char *background);
 DC *initdc(void);
+DC *initdc_headless(void);
 void initfont(DC *dc, const char *fontstr);
 void mapdc(DC *dc, Window win, unsigned int w, unsigned int h);
+void mapdcrect(DC *dc, Window win, int x, int y, unsigned int w, unsigned int h);
 void resizedc(DC *dc, unsigned int w, unsigned int h);
 int textnw(DC *dc, const char *text, size_t len);
 int textw(DC *dc, const char *text);
+int writedc(DC *dc, const char *path);
+void textw_stats(unsigned long *hit, unsigned long *miss);
@@ -17,6 +17,11 @@ fork_and_exec(char **argv, int fd_in, int fd_out, int fd_err) {
     pid_t ret = fork();
     if (ret < 0) return ret;
     if (ret == 0) {
+        /* signals blocked for signalfd would stay blocked across exec */
+        sigset_t set;
+        sigemptyset(&set);
+        sigprocmask(SIG_SETMASK, &set, NULL);
+
         if (fd_in != STDIN_FILENO) {
             if (fd_in < 0)
                 fd_in = open("/dev/null", O_RDONLY);
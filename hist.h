@@ -1,12 +1,14 @@
 #ifndef __DLAUNCHER_HIST_H__
 #define __DLAUNCHER_HIST_H__
 
+#include <time.h>
+
 void hist_add(const char *plugin_name, const char *text);
-void hist_add_line(const char *line);
+/* add [line] used at [t], its frecency grows by [weight] */
+void hist_add_line(const char *line, time_t t, double weight);
 void hist_apply(const char *line);
 
 #define HIST_SIZE 8192
-#define HIST_CMP_MAX 16
 
 extern const char *hist_line[];
 extern int         hist_count;
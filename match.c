@@ -0,0 +1,257 @@
+#include "match.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCORE_MATCH        16
+#define BONUS_BOUNDARY      8
+#define BONUS_CONSECUTIVE   8
+#define BONUS_PREFIX       32
+#define PENALTY_GAP         2
+
+void
+match_refine_init(match_refine_t r) {
+    memset(r, 0, sizeof(match_refine_s));
+}
+
+void
+match_refine_free(match_refine_t r) {
+    int i;
+    for (i = 0; i < MATCH_REFINE_DEPTH; ++ i)
+        free(r->level[i].index);
+    free(r->input);
+    free(r->rank);
+    match_refine_init(r);
+}
+
+void
+match_refine_reset(match_refine_t r, unsigned int corpus) {
+    r->depth  = 0;
+    r->corpus = corpus;
+}
+
+static int
+_level_reserve(match_level_s *l, unsigned int size) {
+    if (l->alloc >= size) return 0;
+    unsigned int alloc = l->alloc ? l->alloc : 16;
+    while (alloc < size) alloc <<= 1;
+    unsigned int *index = (unsigned int *)realloc(l->index, sizeof(unsigned int) * alloc);
+    if (!index) return -1;
+    l->index = index;
+    l->alloc = alloc;
+    return 0;
+}
+
+int
+match_refine(match_refine_t r, const char *input,
+             match_test_fn test, void *ctx,
+             const unsigned int **result, unsigned int *count) {
+    size_t len = strlen(input);
+    size_t common = 0;
+
+    if (r->depth > 0)
+        while (common < len && r->input[common] &&
+               r->input[common] == input[common]) ++ common;
+
+    /* pop the levels answering inputs that are no longer prefixes */
+    while (r->depth > 0 && r->level[r->depth - 1].len > common)
+        -- r->depth;
+
+    if (r->depth > 0 && r->level[r->depth - 1].len == len) {
+        *result = r->level[r->depth - 1].index;
+        *count  = r->level[r->depth - 1].count;
+        return 0;
+    }
+
+    if (r->input_alloc < len + 1) {
+        char *buf = (char *)realloc(r->input, len + 1);
+        if (!buf) goto failed;
+        r->input = buf;
+        r->input_alloc = len + 1;
+    }
+    memcpy(r->input, input, len + 1);
+
+    /* keep the deepest level a refinement of the one below */
+    if (r->depth == MATCH_REFINE_DEPTH) {
+        match_level_s t = r->level[r->depth - 1];
+        r->level[r->depth - 1] = r->level[r->depth - 2];
+        r->level[r->depth - 2] = t;
+        -- r->depth;
+    }
+
+    match_level_s *base = r->depth > 0 ? &r->level[r->depth - 1] : NULL;
+    match_level_s *l = &r->level[r->depth];
+    unsigned int i, n = base ? base->count : r->corpus;
+
+    if (_level_reserve(l, n)) goto failed;
+
+    l->count = 0;
+    l->len   = len;
+    if (base) {
+        for (i = 0; i < n; ++ i)
+            if (test(ctx, base->index[i], input))
+                l->index[l->count ++] = base->index[i];
+    } else {
+        for (i = 0; i < n; ++ i)
+            if (test(ctx, i, input))
+                l->index[l->count ++] = i;
+    }
+    ++ r->depth;
+
+    *result = l->index;
+    *count  = l->count;
+    return 0;
+
+  failed:
+    r->depth = 0;
+    *result  = NULL;
+    *count   = 0;
+    return -1;
+}
+
+static int
+_eq(unsigned char a, unsigned char b) {
+    return a == b || (match_icase && match_fold(a) == match_fold(b));
+}
+
+static int
+_boundary(const char *s, size_t i) {
+    if (i == 0) return 1;
+    unsigned char p = s[i - 1], c = s[i];
+    if (p == '/' || p == '-' || p == '_' || p == '.' || p == ' ') return 1;
+    return islower(p) && isupper(c);
+}
+
+int
+match_fuzzy(const char *s, const char *input) {
+    size_t i, j, start, end;
+    size_t m = strlen(input);
+
+    if (m == 0) return 0;
+
+    /* forward, find the earliest end of a match */
+    for (i = j = 0; s[i] && j < m; ++ i)
+        if (_eq(s[i], input[j])) ++ j;
+    if (j < m) return -1;
+    end = i;
+
+    /* backward, find the shortest window ending there */
+    for (i = end, j = m; j > 0; ) {
+        -- i;
+        if (_eq(s[i], input[j - 1])) -- j;
+    }
+    start = i;
+
+    int score = start == 0 ? BONUS_PREFIX : 0;
+    int run = 0;
+    for (i = start, j = 0; i < end; ++ i) {
+        if (j < m && _eq(s[i], input[j])) {
+            score += SCORE_MATCH + BONUS_CONSECUTIVE * run;
+            if (_boundary(s, i)) score += BONUS_BOUNDARY;
+            ++ run;
+            ++ j;
+        } else {
+            score -= PENALTY_GAP;
+            run = 0;
+        }
+    }
+    return score;
+}
+
+/* [a] ranks before [b] */
+static int
+_better(const match_rank_s *a, const match_rank_s *b) {
+    return a->score > b->score || (a->score == b->score && a->index < b->index);
+}
+
+/* sift down in a heap with the worst entry at the top */
+static void
+_sift(match_rank_s *heap, unsigned int size, unsigned int i) {
+    while (1) {
+        unsigned int c = i * 2 + 1;
+        if (c >= size) break;
+        if (c + 1 < size && _better(&heap[c], &heap[c + 1])) ++ c;
+        if (!_better(&heap[i], &heap[c])) break;
+        match_rank_s t = heap[i]; heap[i] = heap[c]; heap[c] = t;
+        i = c;
+    }
+}
+
+static int
+_rank_comp(const void *a, const void *b) {
+    return _better((const match_rank_s *)a, (const match_rank_s *)b) ? -1 : 1;
+}
+
+void
+match_topk(match_rank_s *rank, unsigned int count, unsigned int k) {
+    unsigned int i, j;
+
+    if (k > count) k = count;
+    if (k == 0) return;
+
+    /* keep the best k in a bounded heap */
+    match_rank_s *heap = (match_rank_s *)malloc(sizeof(match_rank_s) * k);
+    if (!heap) return;
+    memcpy(heap, rank, sizeof(match_rank_s) * k);
+    for (i = k / 2; i-- > 0; ) _sift(heap, k, i);
+    for (i = k; i < count; ++ i) {
+        if (_better(&rank[i], &heap[0])) {
+            heap[0] = rank[i];
+            _sift(heap, k, 0);
+        }
+    }
+    qsort(heap, k, sizeof(match_rank_s), &_rank_comp);
+
+    /* the rest follow in index order, [rank] is sorted by index and
+     * every entry ranking before the worst of the heap is selected */
+    for (i = j = count; i-- > 0; ) {
+        if (!_better(&rank[i], &heap[k - 1]) &&
+            !(rank[i].index == heap[k - 1].index))
+            rank[-- j] = rank[i];
+    }
+    memcpy(rank, heap, sizeof(match_rank_s) * k);
+    free(heap);
+}
+
+typedef struct _query_ctx_s {
+    match_get_fn get;
+    void        *ctx;
+} _query_ctx_s;
+
+static int
+_query_test(void *ctx, unsigned int index, const char *input) {
+    _query_ctx_s *q = (_query_ctx_s *)ctx;
+    /* subsequence test only, scoring is done on the survivors */
+    return match_subseq(q->get(q->ctx, index), input);
+}
+
+int
+match_query(match_refine_t r, const char *input,
+            match_get_fn get, void *ctx,
+            const match_rank_s **rank, unsigned int *count) {
+    _query_ctx_s q = { get, ctx };
+    const unsigned int *result;
+    unsigned int i, n;
+
+    *rank  = NULL;
+    *count = 0;
+    if (match_refine(r, input, &_query_test, &q, &result, &n)) return -1;
+
+    if (r->rank_alloc < n) {
+        match_rank_s *buf = (match_rank_s *)realloc(r->rank, sizeof(match_rank_s) * n);
+        if (!buf) return -1;
+        r->rank = buf;
+        r->rank_alloc = n;
+    }
+
+    for (i = 0; i < n; ++ i) {
+        r->rank[i].index = result[i];
+        r->rank[i].score = match_fuzzy(get(ctx, result[i]), input);
+    }
+    match_topk(r->rank, n, MATCH_TOPK);
+
+    *rank  = r->rank;
+    *count = n;
+    return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef __DLAUNCHER_MATCH_H__
+#define __DLAUNCHER_MATCH_H__
+
+#include <stddef.h>
+
+#if __cplusplus
+extern "C" {
+#endif
+
+    /* incremental query refinement
+     *
+     * A refine state remembers the surviving candidate indexes of the
+     * last inputs, one level per input length. When the new input
+     * extends the previous one, only the survivors of the longest
+     * cached prefix are tested again; when characters are removed,
+     * the cached levels are popped back. The test must be monotone:
+     * anything matching an input must match all its prefixes.
+     */
+
+    /* return non-zero if the candidate [index] matches [input] */
+    typedef int (*match_test_fn)(void *ctx, unsigned int index, const char *input);
+
+    #define MATCH_REFINE_DEPTH 64
+
+    typedef struct match_level_s {
+        size_t        len;      /* length of the input prefix answered */
+        unsigned int *index;    /* surviving indexes, ascending */
+        unsigned int  count;
+        unsigned int  alloc;
+    } match_level_s;
+
+    typedef struct match_refine_s *match_refine_t;
+    typedef struct match_refine_s {
+        char          *input;   /* input answered by the deepest level */
+        size_t         input_alloc;
+        unsigned int   corpus;  /* number of candidates in the corpus */
+        int            depth;
+        match_level_s  level[MATCH_REFINE_DEPTH];
+        /* ranking buffer of match_query() */
+        struct match_rank_s *rank;
+        unsigned int   rank_alloc;
+    } match_refine_s;
+
+    void match_refine_init(match_refine_t r);
+    void match_refine_free(match_refine_t r);
+    /* drop all cached levels, called whenever the corpus changes */
+    void match_refine_reset(match_refine_t r, unsigned int corpus);
+    /* filter the corpus by [input], result is valid until the next call */
+    int  match_refine(match_refine_t r, const char *input,
+                      match_test_fn test, void *ctx,
+                      const unsigned int **result, unsigned int *count);
+
+    /* scored fuzzy matching
+     *
+     * Candidates match when the input is a subsequence of them. The
+     * score rewards matches on word boundaries, consecutive runs and a
+     * match starting at the beginning of the candidate, and penalizes
+     * gaps. Only the best MATCH_TOPK results are fully ordered, that is
+     * the visible page plus a margin; the rest keep the corpus order.
+     */
+
+    #define MATCH_TOPK 128
+
+    typedef struct match_rank_s {
+        unsigned int index;
+        int          score;
+    } match_rank_s;
+
+    /* return the candidate string at [index] */
+    typedef const char *(*match_get_fn)(void *ctx, unsigned int index);
+
+    /* return the score of [s] against [input], or -1 if it does not match */
+    int  match_fuzzy(const char *s, const char *input);
+    /* order the best [k] entries first, keep the others in index order */
+    void match_topk(match_rank_s *rank, unsigned int count, unsigned int k);
+    /* refine the corpus by [input] and rank the survivors; the result
+     * is valid until the next call on [r] */
+    int  match_query(match_refine_t r, const char *input,
+                     match_get_fn get, void *ctx,
+                     const match_rank_s **rank, unsigned int *count);
+
+    /* vectorized kernels, see match_simd.c */
+
+    /* non-zero for case-insensitive matching of ASCII letters */
+    extern int match_icase;
+
+    /* the case folding of match_icase, the same in every locale */
+    static inline int
+    match_fold(int c) {
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+
+    /* name of the kernel implementation selected for this cpu */
+    const char *match_kernel(void);
+    /* like strstr(), honours match_icase */
+    const char *match_strstr(const char *s, const char *sub);
+    /* return non-zero if [input] is a subsequence of [s], honours match_icase */
+    int         match_subseq(const char *s, const char *input);
+
+#if __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,163 @@
+// match_bench: time the kernels of match_simd.c against std::string::find
+//
+// usage: match_bench [rounds]
+//
+// The corpora are the executables in $PATH and the entries of
+// ~/.dlauncher_history, as the cmd and hist plugins see them. Needles
+// are pieces of random candidates of 1 to 6 bytes, plus a few that
+// never match.
+
+#include "match.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+static double
+now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+load_path(vector<string> &corpus) {
+    const char *env = getenv("PATH");
+    if (!env) return;
+
+    string path(env);
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find(':', start);
+        if (end == string::npos) end = path.size();
+        DIR *d = opendir(path.substr(start, end - start).c_str());
+        if (d) {
+            struct dirent *e;
+            while ((e = readdir(d)) != NULL)
+                if (e->d_name[0] != '.') corpus.push_back(e->d_name);
+            closedir(d);
+        }
+        start = end + 1;
+    }
+    sort(corpus.begin(), corpus.end());
+    corpus.erase(unique(corpus.begin(), corpus.end()), corpus.end());
+}
+
+static void
+load_history(vector<string> &corpus) {
+    const char *home = getenv("HOME");
+    if (!home) return;
+
+    string path = string(home) + "/.dlauncher_history";
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f) return;
+
+    char *line = NULL; size_t line_size; ssize_t r;
+    while ((r = getline(&line, &line_size, f)) >= 0) {
+        if (r > 0 && line[r - 1] == '\n') line[-- r] = 0;
+        // skip the time records of the journal
+        const char *colon = strchr(line, ':');
+        if (line[0] == '@' || !colon) continue;
+        corpus.push_back(colon + 1);
+    }
+    free(line);
+    fclose(f);
+}
+
+static void
+make_needles(const vector<string> &corpus, vector<string> &needles) {
+    srand(1);
+    for (int i = 0; i < 64 && !corpus.empty(); ++ i) {
+        const string &s = corpus[rand() % corpus.size()];
+        if (s.empty()) continue;
+        size_t len = 1 + rand() % 6;
+        if (len > s.size()) len = s.size();
+        needles.push_back(s.substr(rand() % (s.size() - len + 1), len));
+    }
+    needles.push_back("zqxj");
+    needles.push_back("#%");
+}
+
+static bool
+icase_find(const string &s, const string &needle) {
+    return search(s.begin(), s.end(), needle.begin(), needle.end(),
+                  [](char a, char b) { return tolower((unsigned char)a) == tolower((unsigned char)b); })
+        != s.end();
+}
+
+static bool
+scalar_subseq(const string &s, const string &needle) {
+    size_t j = 0;
+    for (size_t i = 0; i < s.size() && j < needle.size(); ++ i)
+        if (s[i] == needle[j]) ++ j;
+    return j == needle.size();
+}
+
+// run [test] over the corpus for every needle, print ns per candidate
+template <class Test>
+static void
+run(const char *name, const vector<string> &corpus, const vector<string> &needles,
+    int rounds, Test test) {
+    unsigned long hits = 0;
+    double start = now_ms();
+    for (int r = 0; r < rounds; ++ r)
+        for (size_t n = 0; n < needles.size(); ++ n)
+            for (size_t i = 0; i < corpus.size(); ++ i)
+                hits += test(corpus[i], needles[n]);
+    double ms = now_ms() - start;
+    double tests = (double)rounds * needles.size() * corpus.size();
+    printf("  %-24s %8.2f ns/candidate  %lu hits\n", name, tests ? ms * 1e6 / tests : 0, hits);
+}
+
+static void
+bench(const char *name, const vector<string> &corpus, int rounds) {
+    vector<string> needles;
+    make_needles(corpus, needles);
+    printf("%s: %zu candidates, %zu needles\n", name, corpus.size(), needles.size());
+    if (corpus.empty()) return;
+
+    match_icase = 0;
+    run("std::string::find", corpus, needles, rounds,
+        [](const string &s, const string &n) { return s.find(n) != string::npos; });
+    run("strstr", corpus, needles, rounds,
+        [](const string &s, const string &n) { return strstr(s.c_str(), n.c_str()) != NULL; });
+    run("match_strstr", corpus, needles, rounds,
+        [](const string &s, const string &n) { return match_strstr(s.c_str(), n.c_str()) != NULL; });
+    run("subsequence, scalar", corpus, needles, rounds, &scalar_subseq);
+    run("match_subseq", corpus, needles, rounds,
+        [](const string &s, const string &n) { return match_subseq(s.c_str(), n.c_str()) != 0; });
+
+    run("icase std::search", corpus, needles, rounds, &icase_find);
+    match_icase = 1;
+    run("icase match_strstr", corpus, needles, rounds,
+        [](const string &s, const string &n) { return match_strstr(s.c_str(), n.c_str()) != NULL; });
+    match_icase = 0;
+}
+
+int
+main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    vector<string> path, history;
+
+    if (rounds <= 0) {
+        fprintf(stderr, "usage: match_bench [rounds]\n");
+        return EXIT_FAILURE;
+    }
+
+    load_path(path);
+    load_history(history);
+
+    printf("kernel: %s\n", match_kernel());
+    bench("PATH", path, rounds);
+    bench("history", history, rounds);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,229 @@
+#include "match.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MATCH_X86
+#include <immintrin.h>
+#endif
+
+/* vectorized substring and subsequence kernels
+ *
+ * The substring kernels compare the first and the last byte of the
+ * needle against a whole vector of candidate positions at once and
+ * only verify the positions where both agree. In case-insensitive
+ * mode, ASCII letters of the candidate are folded in the vector before
+ * comparing. The implementation is picked once at startup according
+ * to the cpu features.
+ */
+
+int match_icase = 0;
+
+typedef const char *(*_find_fn)(const char *s, size_t n, const char *p, size_t m);
+typedef const char *(*_chr_fn)(const char *s, size_t n, char c);
+
+/* compare [n] bytes, [p] is already folded in case-insensitive mode */
+static int
+_eqn(const char *s, const char *p, size_t n) {
+    size_t i;
+    if (!match_icase) return memcmp(s, p, n) == 0;
+    for (i = 0; i < n; ++ i)
+        if (match_fold((unsigned char)s[i]) != (unsigned char)p[i]) return 0;
+    return 1;
+}
+
+static const char *
+_find_scalar(const char *s, size_t n, const char *p, size_t m) {
+    size_t i;
+    if (!match_icase) {
+        const char *c;
+        for (i = 0; i + m <= n; i = c - s + 1) {
+            c = (const char *)memchr(s + i, p[0], n - m + 1 - i);
+            if (!c) break;
+            if (memcmp(c + 1, p + 1, m - 1) == 0) return c;
+        }
+        return NULL;
+    }
+    for (i = 0; i + m <= n; ++ i)
+        if (_eqn(s + i, p, m)) return s + i;
+    return NULL;
+}
+
+static const char *
+_chr_scalar(const char *s, size_t n, char c) {
+    size_t i;
+    if (!match_icase) return (const char *)memchr(s, c, n);
+    for (i = 0; i < n; ++ i)
+        if (match_fold((unsigned char)s[i]) == c) return s + i;
+    return NULL;
+}
+
+#ifdef MATCH_X86
+
+static inline __m128i
+_lower128(__m128i v) {
+    __m128i ge = _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1));
+    __m128i le = _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v);
+    return _mm_or_si128(v, _mm_and_si128(_mm_and_si128(ge, le), _mm_set1_epi8(0x20)));
+}
+
+static const char *
+_find_sse2(const char *s, size_t n, const char *p, size_t m) {
+    __m128i first = _mm_set1_epi8(p[0]);
+    __m128i last  = _mm_set1_epi8(p[m - 1]);
+    size_t i;
+
+    for (i = 0; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + m - 1));
+        if (match_icase) {
+            a = _lower128(a);
+            b = _lower128(b);
+        }
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (m <= 2 || _eqn(s + i + bit + 1, p + 1, m - 2))
+                return s + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return _find_scalar(s + i, n - i, p, m);
+}
+
+static const char *
+_chr_sse2(const char *s, size_t n, char c) {
+    __m128i v = _mm_set1_epi8(c);
+    size_t i;
+
+    if (!match_icase) return (const char *)memchr(s, c, n);
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i a = _lower128(_mm_loadu_si128((const __m128i *)(s + i)));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, v));
+        if (mask) return s + i + __builtin_ctz(mask);
+    }
+    return _chr_scalar(s + i, n - i, c);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+_lower256(__m256i v) {
+    __m256i ge = _mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1));
+    __m256i le = _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v);
+    return _mm256_or_si256(v, _mm256_and_si256(_mm256_and_si256(ge, le), _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"))) static const char *
+_find_avx2(const char *s, size_t n, const char *p, size_t m) {
+    __m256i first = _mm256_set1_epi8(p[0]);
+    __m256i last  = _mm256_set1_epi8(p[m - 1]);
+    size_t i;
+
+    for (i = 0; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + m - 1));
+        if (match_icase) {
+            a = _lower256(a);
+            b = _lower256(b);
+        }
+        unsigned int mask = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (m <= 2 || _eqn(s + i + bit + 1, p + 1, m - 2))
+                return s + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return _find_sse2(s + i, n - i, p, m);
+}
+
+__attribute__((target("avx2"))) static const char *
+_chr_avx2(const char *s, size_t n, char c) {
+    __m256i v = _mm256_set1_epi8(c);
+    size_t i;
+
+    if (!match_icase) return (const char *)memchr(s, c, n);
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i a = _lower256(_mm256_loadu_si256((const __m256i *)(s + i)));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, v));
+        if (mask) return s + i + __builtin_ctz(mask);
+    }
+    return _chr_sse2(s + i, n - i, c);
+}
+
+#endif
+
+static _find_fn    _find = &_find_scalar;
+static _chr_fn     _chr  = &_chr_scalar;
+static const char *_kernel = "scalar";
+
+static __attribute__((constructor)) void
+_dispatch(void) {
+#ifdef MATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        _find   = &_find_avx2;
+        _chr    = &_chr_avx2;
+        _kernel = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        _find   = &_find_sse2;
+        _chr    = &_chr_sse2;
+        _kernel = "sse2";
+    }
+#endif
+}
+
+const char *
+match_kernel(void) {
+    return _kernel;
+}
+
+/* fold the needle once so that kernels only fold the candidate; kept
+ * apart so that the case-sensitive path has no large stack frame */
+static __attribute__((noinline)) const char *
+_find_icase(const char *s, size_t n, const char *sub, size_t m) {
+    char buf[BUFSIZ];
+    size_t i, j;
+
+    if (m > sizeof(buf)) {
+        /* too long to fold up front, both sides are folded instead */
+        for (i = 0; i + m <= n; ++ i) {
+            for (j = 0; j < m; ++ j)
+                if (match_fold((unsigned char)s[i + j]) != match_fold((unsigned char)sub[j]))
+                    break;
+            if (j == m) return s + i;
+        }
+        return NULL;
+    }
+    for (i = 0; i < m; ++ i) buf[i] = match_fold((unsigned char)sub[i]);
+    return _find(s, n, buf, m);
+}
+
+const char *
+match_strstr(const char *s, const char *sub) {
+    size_t m = strlen(sub);
+    size_t n = strlen(s);
+
+    if (m == 0) return s;
+    if (m > n) return NULL;
+    if (match_icase) return _find_icase(s, n, sub, m);
+    return _find(s, n, sub, m);
+}
+
+int
+match_subseq(const char *s, const char *input) {
+    size_t m = strlen(input);
+    size_t n = strlen(s);
+    const char *end = s + n;
+    size_t i;
+
+    if (m > n) return 0;
+    for (i = 0; i < m; ++ i) {
+        const char *c = _chr(s, end - s, match_icase ? match_fold((unsigned char)input[i]) : input[i]);
+        if (!c) return 0;
+        s = c + 1;
+    }
+    return 1;
+}
@@ -22,6 +22,15 @@
 #define PL_TYPE_EXEC 0
 #define PL_TYPE_SOCK 1
 
+/* parts of a 'B' reply of the v2 protocol, see README */
+#define EP_FRAME_COUNT 0
+#define EP_FRAME_ITEM  1
+#define EP_FRAME_DESC  2
+#define EP_FRAME_TEXT  3
+#define EP_FRAME_MAX   (1 << 20)    /* longest desc or text accepted */
+/* item flags */
+#define EP_ITEM_STICKY 1            /* kept when an 'f' reply filters */
+
 #define NDEBUG
 
 #ifndef NDEBUG
@@ -38,11 +47,27 @@ typedef struct ep_priv_s {
     char  *retry_cmd;
     int    retry_delay;
 
-    /* ready for next query */
-    int    ready;
+    /* number of queries sent whose reply is not complete; replies come
+     * in order, so only the last one answers the current input */
+    int    pending;
+    /* type of the reply being received, 0 while waiting for one */
+    int    reply;
+    /* the list was sent for a superseded query, hide it */
+    int    list_stale;
+    /* send the generation of each query, see README */
+    int    gen;
+    /* protocol version announced to the plugin */
+    int    proto;
+    /* the current input */
+    char  *input;
+
+    dl_plugin_t self;
+    /* monitor id of the reply fd, -1 if not monitored */
+    int    watch;
     /* for exec */
     int    stdin_fd;
     int    stdout_fd;
+    pid_t  child;
     /* for sock */
     int    conn;
     
@@ -57,6 +82,16 @@ typedef struct ep_priv_s {
     int   *desc;
     int   *text;
     int   *filter;
+    int   *score;
+    int   *flags;
+
+    /* 'B' reply being received */
+    int    frame_state;
+    unsigned char frame[16];        /* header received so far */
+    size_t frame_len;
+    unsigned int frame_items;       /* items left */
+    unsigned int frame_need;        /* bytes left in the current string */
+    unsigned int frame_text_len;
 
     char  *recv_buf;
     int    rb_alloc;
@@ -133,6 +168,18 @@ external_plugin_create(const char *name, const char *entry, const char *opt) {
     char *async = _get_opt(opt, "ASYNC");
     p->async = async && *async;
     free(async);
+
+    char *debounce = _get_opt(opt, "DEBOUNCE");
+    plugin->debounce = debounce ? atoi(debounce) : 0;
+    free(debounce);
+
+    char *gen = _get_opt(opt, "GEN");
+    p->gen = gen && *gen;
+    free(gen);
+
+    char *proto = _get_opt(opt, "PROTO");
+    p->proto = proto ? atoi(proto) : 1;
+    free(proto);
     
     char *retry_delay = _get_opt(opt, "RETRY_DELAY");
     p->retry_delay = retry_delay ? atoi(retry_delay) : 3;
@@ -149,6 +196,8 @@ external_plugin_create(const char *name, const char *entry, const char *opt) {
 
     plugin->priv = p;
     plugin->item_count = 0;
+    p->self  = plugin;
+    p->watch = -1;
     
     plugin->init     = &_init;
     plugin->query    = &_query;
@@ -161,6 +210,15 @@ external_plugin_create(const char *name, const char *entry, const char *opt) {
     return register_plugin(plugin);
 }
 
+static ssize_t _write(ep_priv_t p, const void *buf, size_t size);
+
+/* announce the protocol version on a new connection */
+static int
+_hello(ep_priv_t p) {
+    if (p->proto < 2) return 0;
+    return _write(p, "v2\n", 3) == 3 ? 0 : -1;
+}
+
 static int
 _connect(ep_priv_t p) {
     if (p->type == PL_TYPE_EXEC) {
@@ -191,8 +249,10 @@ _connect(ep_priv_t p) {
             
             p->stdin_fd  = in_pfd[1];
             p->stdout_fd = out_pfd[0];
-            p->ready = 1;
-            return 0;
+            p->child   = c;
+            p->pending = 0;
+            p->reply   = 0;
+            return _hello(p);
         }
         
       onerr:
@@ -210,7 +270,7 @@ _connect(ep_priv_t p) {
         char *rcmd;
         time_t ts;
     
-        if ((p->conn = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        if ((p->conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
             goto err;
         }
 
@@ -223,8 +283,9 @@ _connect(ep_priv_t p) {
             goto err;
         }
 
-        p->ready = 1;
-        return 0;
+        p->pending = 0;
+        p->reply   = 0;
+        return _hello(p);
     
       err:
         return p->conn = -1;
@@ -232,13 +293,36 @@ _connect(ep_priv_t p) {
 }
 
 static void
-_reset_for_retry(ep_priv_t p) {
+_disconnect(ep_priv_t p) {
+    if (p->watch >= 0) {
+        unregister_update_fd(p->self, p->watch);
+        p->watch = -1;
+    }
     if (p->type == PL_TYPE_EXEC) {
         if (p->stdin_fd >= 0)  close(p->stdin_fd); p->stdin_fd = -1;
         if (p->stdout_fd >= 0) close(p->stdout_fd); p->stdout_fd = -1;
     } else if (p->type == PL_TYPE_SOCK) {
         if (p->conn >= 0) close(p->conn); p->conn = -1;
     }
+}
+
+void
+external_plugin_close(dl_plugin_t plugin) {
+    if (plugin->init != &_init) return;
+    ep_priv_t p = (ep_priv_t)plugin->priv;
+    /* a plugin run by us may not quit on its closed input */
+    if (p->type == PL_TYPE_EXEC && p->stdin_fd >= 0 && p->child > 0)
+        kill(p->child, SIGTERM);
+    _disconnect(p);
+}
+
+static void
+_reset_for_retry(ep_priv_t p) {
+    _disconnect(p);
+    /* replies of the lost connection never come */
+    p->pending    = 0;
+    p->reply      = 0;
+    p->list_stale = 0;
 
     time_t ts;
     time(&ts);
@@ -299,15 +383,17 @@ _setnonblocking(ep_priv_t p, int nonblocking) {
     } else return -1;
 }
 
+/* the reply fd stays monitored until the connection is reset */
 static int
 _register_fd(dl_plugin_t self, ep_priv_t p) {
+    if (p->watch >= 0) return 0;
     if (p->type == PL_TYPE_SOCK) {
         _setnonblocking(p, 1);
-        register_update_fd(self, p->conn, DL_FD_EVENT_READ | DL_FD_EVENT_STATUS);
+        p->watch = register_update_fd(self, p->conn, DL_FD_EVENT_READ | DL_FD_EVENT_STATUS);
         return 0;
     } else if (p->type == PL_TYPE_EXEC) {
         _setnonblocking(p, 1);
-        register_update_fd(self, p->stdout_fd, DL_FD_EVENT_READ | DL_FD_EVENT_STATUS);
+        p->watch = register_update_fd(self, p->stdout_fd, DL_FD_EVENT_READ | DL_FD_EVENT_STATUS);
         return 0;
     } else return -1;
 }
@@ -319,10 +405,14 @@ _init(dl_plugin_t self) {
     p->conn      = -1;
     p->stdin_fd  = -1;
     p->stdout_fd = -1;
+    p->child     = -1;
 
     p->ts_init_flag = 0;
 
-    p->ready        = 1;
+    p->pending      = 0;
+    p->reply        = 0;
+    p->list_stale   = 0;
+    p->input        = NULL;
     
     p->item_alloc   = 0;
     p->item_count   = 0;
@@ -330,6 +420,8 @@ _init(dl_plugin_t self) {
     p->desc         = NULL;
     p->text         = NULL;
     p->filter       = NULL;
+    p->score        = NULL;
+    p->flags        = NULL;
 
     p->recv_buf     = NULL;
     p->rb_alloc     = 0;
@@ -340,13 +432,69 @@ _init(dl_plugin_t self) {
 }
 
 #define CLEAR do { free(p->desc); free(p->text); free(p->filter); free(p->recv_buf); \
+        free(p->score); free(p->flags);                                 \
         p->desc = NULL; p->text = NULL; p->filter = NULL; p->recv_buf = NULL; \
+        p->score = NULL; p->flags = NULL;                               \
         p->item_alloc = p->item_count = p->filter_count = p->rb_alloc = 0; } while (0)
 
-int
-_update_cache(ep_priv_t p) {
-    if (p->ready) return 0;
-    
+typedef struct ep_rank_s {
+    int score;
+    int id;
+} ep_rank_s;
+
+static int
+_rank_comp(const void *a, const void *b) {
+    const ep_rank_s *ra = (const ep_rank_s *)a, *rb = (const ep_rank_s *)b;
+    /* higher score first, then in the order received */
+    if (ra->score != rb->score) return ra->score < rb->score ? 1 : -1;
+    return ra->id - rb->id;
+}
+
+/* order the shown items by their scores, only those of a 'B' reply
+ * may have any */
+static void
+_rank_items(ep_priv_t p) {
+    int i;
+
+    for (i = 0; i < p->filter_count && p->score[p->filter[i]] == 0; ++ i);
+    if (i == p->filter_count) return;
+
+    ep_rank_s *rank = (ep_rank_s *)malloc(sizeof(ep_rank_s) * p->filter_count);
+    if (!rank) return;
+    for (i = 0; i < p->filter_count; ++ i) {
+        rank[i].score = p->score[p->filter[i]];
+        rank[i].id    = p->filter[i];
+    }
+    qsort(rank, p->filter_count, sizeof(ep_rank_s), &_rank_comp);
+    for (i = 0; i < p->filter_count; ++ i) p->filter[i] = rank[i].id;
+    free(rank);
+}
+
+/* a reply is complete */
+static void
+_reply_done(ep_priv_t p) {
+    int reply = p->reply;
+
+    p->reply = 0;
+    if (-- p->pending > 0) return;  /* answer of a superseded query */
+
+    if (reply == 'f') {
+        // reuse the old candidates
+        int i, input_len = strlen(p->input);
+        p->filter_count = 0;
+        for (i = 0; i < p->item_count; ++ i) {
+            if ((p->flags[i] & EP_ITEM_STICKY) ||
+                !strncmp(p->recv_buf + p->text[i], p->input, input_len))
+                p->filter[p->filter_count ++] = i;
+        }
+        p->list_stale = 0;
+        _rank_items(p);
+    } else if (reply == 'B') _rank_items(p);
+}
+
+/* make room in the receive buffer for [size] more bytes */
+static int
+_reserve_buf(ep_priv_t p, size_t size) {
     /* create recv buf */
     if (!p->recv_buf) {
         p->recv_buf = (char *)malloc(1024);
@@ -356,61 +504,48 @@ _update_cache(ep_priv_t p) {
         p->rb_stamp = 0;
     }
 
-    DEBUG(fprintf(stderr, "uc: recv\n"));
-
-    /* read as much data as possible */
-    char buf[1024];
-    while (1) {
-        ssize_t r = _read(p, buf, sizeof(buf));
-        /* fprintf(stderr, "recv %d [%s]\n", r, string(buf, r).c_str()); */
-        if (r < 0) {
-            if (r == -EAGAIN || r == -EWOULDBLOCK) {
-                break;
-            } else {
-                CLEAR;
-                _reset_for_retry(p);
-                return -1;
-            }
-        } else if (r == 0) {
-            CLEAR;
-            _reset_for_retry(p);
-            return -1;
-        }
-
-        while (p->rb_alloc < p->rb_size + r) {
-            p->recv_buf = (char *)realloc(p->recv_buf, p->rb_alloc << 1);
-            if (p->recv_buf == NULL) {
-                CLEAR;
-                _reset_for_retry(p);
-                return -1;
-            } else p->rb_alloc <<= 1;
-        }
+    while ((size_t)p->rb_alloc < p->rb_size + size) {
+        p->recv_buf = (char *)realloc(p->recv_buf, p->rb_alloc << 1);
+        if (p->recv_buf == NULL) return -1;
+        else p->rb_alloc <<= 1;
+    }
+    return 0;
+}
 
-        memcpy(p->recv_buf + p->rb_size, buf, r);
-        p->rb_size += r;
-        
-        if (buf[r - 1] == '\0') {
-            break;
-        }
+/* make room for one more item */
+static int
+_reserve_item(ep_priv_t p) {
+    int alloc = p->item_alloc ? p->item_alloc : 16;
+
+    while (alloc <= p->item_count) alloc <<= 1;
+    if (alloc == p->item_alloc) return 0;
+
+    if (!(p->text   = realloc(p->text, sizeof(int) * alloc)) ||
+        !(p->desc   = realloc(p->desc, sizeof(int) * alloc)) ||
+        !(p->filter = realloc(p->filter, sizeof(int) * alloc)) ||
+        !(p->score  = realloc(p->score, sizeof(int) * alloc)) ||
+        !(p->flags  = realloc(p->flags, sizeof(int) * alloc))) {
+        free(p->text); p->text = NULL;
+        free(p->desc); p->desc = NULL;
+        free(p->filter); p->filter = NULL;
+        free(p->score); p->score = NULL;
+        free(p->flags); p->flags = NULL;
+        p->item_alloc = 0;
+        return -1;
     }
 
-    /* create item and filter space */
-    if (p->item_alloc == 0) {
-        p->text   = malloc(sizeof(int) * 16);
-        p->desc   = malloc(sizeof(int) * 16);
-        p->filter = malloc(sizeof(int) * 16);
+    if (p->item_alloc == 0) p->item_count = p->filter_count = 0;
+    p->item_alloc = alloc;
+    return 0;
+}
 
-        if (!p->text || !p->desc || !p->filter) {
-            free(p->text); p->text = NULL;
-            free(p->desc); p->desc = NULL;
-            free(p->filter); p->filter = NULL;
-            return -1;
-        }
+/* append received body data of a 'c' reply and parse the complete items */
+static int
+_recv_items(ep_priv_t p, const char *data, size_t size) {
+    if (_reserve_buf(p, size)) return -1;
 
-        p->item_alloc = 16;
-        p->item_count = p->filter_count = 0;
-        
-    }
+    memcpy(p->recv_buf + p->rb_size, data, size);
+    p->rb_size += size;
 
     DEBUG(fprintf(stderr, "uc: parse %d %d\n", p->rb_stamp, p->rb_size));
 
@@ -431,21 +566,7 @@ _update_cache(ep_priv_t p) {
                 
                 DEBUG(fprintf(stderr, "find lines:\n%s\n%s\n", f, s));
 
-                while (p->item_alloc <= p->item_count) {
-                    p->text   = realloc(p->text, sizeof(int) * (p->item_alloc << 1));
-                    p->desc   = realloc(p->desc, sizeof(int) * (p->item_alloc << 1));
-                    p->filter = realloc(p->filter, sizeof(int) * (p->item_alloc << 1));
-
-                    if (!p->text || !p->desc || !p->filter) {
-                        free(p->text); p->text = NULL;
-                        free(p->desc); p->desc = NULL;
-                        free(p->filter); p->filter = NULL;
-                        p->item_alloc = 0;
-                        return -1;
-                    }
-
-                    p->item_alloc <<= 1;
-                }
+                if (_reserve_item(p)) return -1;
 
                 int id = p->item_count ++;
                 ++ p->filter_count;
@@ -453,21 +574,143 @@ _update_cache(ep_priv_t p) {
                 p->desc[id]   = f - p->recv_buf;
                 p->text[id]   = s - p->recv_buf;
                 p->filter[id] = id;
+                p->score[id]  = 0;
+                p->flags[id]  = 0;
                 
                 f = s = NULL;
                 p->rb_stamp = c - p->recv_buf + 1;
             }
-        } else if (*c == 0) {
-            p->ready = 1;
-            return 0;
         }
     }
 
     return 0;
 }
 
+static unsigned int
+_u32(const unsigned char *b) {
+    return ((unsigned int)b[0] << 24) | ((unsigned int)b[1] << 16) |
+        ((unsigned int)b[2] << 8) | b[3];
+}
+
+/* take the body data of a 'B' reply, return the number of bytes used
+ * or -1; strings are copied whole by their lengths, never scanned */
+static ssize_t
+_recv_frame(ep_priv_t p, const char *data, size_t size) {
+    size_t used = 0, n;
+
+    while (p->reply == 'B') {
+        if (p->frame_state == EP_FRAME_DESC || p->frame_state == EP_FRAME_TEXT) {
+            n = size - used < p->frame_need ? size - used : p->frame_need;
+            memcpy(p->recv_buf + p->rb_size, data + used, n);
+            p->rb_size += n;
+            p->frame_need -= n;
+            used += n;
+            if (p->frame_need) break;
+
+            p->recv_buf[p->rb_size ++] = 0;
+            if (p->frame_state == EP_FRAME_DESC) {
+                p->frame_state = EP_FRAME_TEXT;
+                p->frame_need = p->frame_text_len;
+                continue;
+            }
+            /* the item is complete */
+            int id = p->item_count ++;
+            p->filter[p->filter_count ++] = id;
+            p->frame_state = EP_FRAME_ITEM;
+            if (-- p->frame_items == 0) _reply_done(p);
+            continue;
+        }
+
+        /* the item count, or the header of an item */
+        size_t want = p->frame_state == EP_FRAME_COUNT ? 4 : 16;
+        n = size - used < want - p->frame_len ? size - used : want - p->frame_len;
+        memcpy(p->frame + p->frame_len, data + used, n);
+        p->frame_len += n;
+        used += n;
+        if (p->frame_len < want) break;
+        p->frame_len = 0;
+
+        if (p->frame_state == EP_FRAME_COUNT) {
+            p->frame_items = _u32(p->frame);
+            p->frame_state = EP_FRAME_ITEM;
+            if (p->frame_items == 0) _reply_done(p);
+            continue;
+        }
+
+        unsigned int desc_len = _u32(p->frame + 8);
+        unsigned int text_len = _u32(p->frame + 12);
+        if (desc_len > EP_FRAME_MAX || text_len > EP_FRAME_MAX) return -1;
+        /* room for the whole item, offsets are known in advance */
+        if (_reserve_buf(p, desc_len + text_len + 2) || _reserve_item(p)) return -1;
+        int id = p->item_count;
+        p->flags[id] = _u32(p->frame);
+        p->score[id] = (int)_u32(p->frame + 4);
+        p->desc[id]  = p->rb_size;
+        p->text[id]  = p->rb_size + desc_len + 1;
+        p->frame_state    = EP_FRAME_DESC;
+        p->frame_need     = desc_len;
+        p->frame_text_len = text_len;
+    }
+    return used;
+}
+
+/* receive once and process the replies in it; return 1 if something
+ * was received, 0 if nothing is available, -1 on error */
+int
+_update_cache(ep_priv_t p) {
+    if (p->pending == 0) return 0;
+    
+    DEBUG(fprintf(stderr, "uc: recv\n"));
+
+    char buf[1024];
+    ssize_t r = _read(p, buf, sizeof(buf));
+    /* fprintf(stderr, "recv %d [%s]\n", r, string(buf, r).c_str()); */
+    if (r == -EAGAIN || r == -EWOULDBLOCK) return 0;
+    else if (r <= 0) return -1;
+
+    ssize_t i = 0;
+    while (i < r) {
+        if (p->reply == 0) {
+            p->reply = buf[i ++];
+            DEBUG(fprintf(stderr, "reply %c\n", p->reply));
+            if (p->reply == 'f' || p->reply == 's') {
+                /* 's' - the plugin dropped a superseded query */
+                _reply_done(p);
+            } else if (p->reply == 'c') {
+                /* rebuild the candidates */
+                CLEAR;
+                p->list_stale = p->pending > 1;
+            } else if (p->reply == 'B' && p->proto >= 2) {
+                /* rebuild the candidates from a binary list */
+                CLEAR;
+                p->list_stale  = p->pending > 1;
+                p->frame_state = EP_FRAME_COUNT;
+                p->frame_len   = 0;
+            } else {
+                /* invalid reply */
+                return -1;
+            }
+        } else if (p->reply == 'B') {
+            ssize_t n = _recv_frame(p, buf + i, r - i);
+            if (n < 0) return -1;
+            i += n;
+        } else {
+            /* the body of a 'c' reply ends with a null byte */
+            char *z = memchr(buf + i, 0, r - i);
+            size_t n = z ? z - (buf + i) : r - i;
+            if (_recv_items(p, buf + i, n)) return -1;
+            i += n;
+            if (z) {
+                ++ i;
+                _reply_done(p);
+            }
+        }
+    }
+    return 1;
+}
+
 static void
-_new_query(ep_priv_t p, const char *input) {
+_new_query(dl_plugin_t self, ep_priv_t p, const char *input) {
     if (_connect(p) != 0) {
         CLEAR;
         _reset_for_retry(p);
@@ -477,6 +720,22 @@ _new_query(ep_priv_t p, const char *input) {
     DEBUG(fprintf(stderr, "connected\n"));
     _setnonblocking(p, 0);
 
+    char *dup = strdup(input);
+    if (!dup) return;
+    free(p->input);
+    p->input = dup;
+
+    // send generation of the query
+    if (p->gen) {
+        char gen[32];
+        int len = snprintf(gen, sizeof(gen), "g%u\n", self->generation);
+        if (_write(p, gen, len) != len) {
+            CLEAR;
+            _reset_for_retry(p);
+            return;
+        }
+    }
+
     // send query prefix
     if (_write(p, "q", 1) != 1) {
         CLEAR;
@@ -505,63 +764,23 @@ _new_query(ep_priv_t p, const char *input) {
         return;
     }
 
-    DEBUG(fprintf(stderr, "sent %d\n", p->ready));
+    /* replies of the previous queries are not waited for, they are
+     * received along with this one */
+    ++ p->pending;
+
+    DEBUG(fprintf(stderr, "sent %d\n", p->pending));
 
-    while (!p->ready) {
-        if (_update_cache(p)) {
+    if (p->async) return;
+
+    DEBUG(fprintf(stderr, "sync recving data\n"));
+    /* sync building, give up once a newer input is waiting */
+    while (p->pending && !dl_query_stale(self)) {
+        if (_update_cache(p) < 0) {
             CLEAR;
             _reset_for_retry(p);
             return;
         }
     }
-
-    /* start new query */
-    p->ready = 0;
-
-    DEBUG(fprintf(stderr, "recv\n"));
-    
-    // recv reply
-    char reply;
-    if (_read(p, &reply, 1) != 1) {
-        CLEAR;
-        _reset_for_retry(p);
-        return;
-    }
-
-    DEBUG(fprintf(stderr, "reply %c\n", reply));
-
-    if (reply == 'f') {
-        // reuse the old candidates
-        int i, input_len = strlen(input);
-        p->filter_count = 0;
-        for (i = 0; i < p->item_count; ++ i) {
-            if (!strncmp(p->recv_buf + p->text[i], input, input_len))
-                p->filter[p->filter_count ++] = i;
-        }
-        p->ready = 1;
-        return;
-    } else if (reply == 'c') {
-        CLEAR;
-        /* rebuild the candidates */
-        if (!p->async) {
-            DEBUG(fprintf(stderr, "sync recving data\n"));
-            /* sync building */
-            while (!p->ready) {
-                if (_update_cache(p)) {
-                    CLEAR;
-                    _reset_for_retry(p);
-                    return;
-                }
-            }
-        }
-        return;
-    } else {
-        /* invalid reply */
-        CLEAR;
-        p->ready = 1;
-        _reset_for_retry(p);
-        return;
-    }
 }
 
 static void
@@ -607,8 +826,8 @@ _send_cmd(ep_priv_t p, const char *cmd, int mode) {
 int
 _query(dl_plugin_t self, const char *input) {
     ep_priv_t p = (ep_priv_t)self->priv;
-    _new_query(p, input);
-    self->item_count = p->filter_count;
+    _new_query(self, p, input);
+    self->item_count = p->list_stale ? 0 : p->filter_count;
     DEBUG(fprintf(stderr, "!!! %d\n", self->item_count));
     return 0;
 }
@@ -616,7 +835,7 @@ _query(dl_plugin_t self, const char *input) {
 int
 _before_update(dl_plugin_t self) {
     ep_priv_t p = (ep_priv_t)self->priv;
-    if (!p->ready && p->async) {
+    if (p->pending && p->async) {
         DEBUG(fprintf(stderr, "add hook\n"));
         _register_fd(self, p);
     }
@@ -625,14 +844,31 @@ _before_update(dl_plugin_t self) {
 int
 _update(dl_plugin_t self) {
     ep_priv_t p = (ep_priv_t)self->priv;
-    if (!p->ready) {
-        if (_update_cache(p)) {
+    int r;
+    _setnonblocking(p, 1);
+    if (!p->pending) {
+        /* nothing is expected, drop the data or notice the hangup */
+        char buf[1024];
+        r = _read(p, buf, sizeof(buf));
+        if (r == 0 || (r < 0 && r != -EAGAIN && r != -EWOULDBLOCK)) {
             CLEAR;
             _reset_for_retry(p);
+            self->item_count = 0;
+            return -1;
+        }
+        return 1;
+    } else {
+        while ((r = _update_cache(p)) > 0 && p->pending);
+        if (r < 0) {
+            CLEAR;
+            _reset_for_retry(p);
+            self->item_count = 0;
             return -1;
-        } else {
-            self->item_count = p->filter_count;
         }
+        self->item_count = p->list_stale ? 0 : p->filter_count;
+        /* data of superseded queries only, nothing to redraw */
+        if (p->list_stale || p->pending > 1 ||
+            (p->pending == 1 && p->reply != 'c' && p->reply != 'B')) return 1;
     }
     DEBUG(fprintf(stderr, "!!! %d\n", self->item_count));
     return 0;
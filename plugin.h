@@ -12,10 +12,14 @@ extern "C" {
         const char *name;   /*  */
         int priority;       /* priority in the combined result list */
         int hist;           /* whether the action to this plugin should be remembered in history */
+        int debounce;       /* ms the input must settle before querying, for expensive plugins */
 
         /* write once by dlauncher */
         int id;             /* unique id in runtime */
 
+        /* write by dlauncher before each query */
+        unsigned int generation; /* increases with every new input */
+
         /* write by the plugin */
         unsigned int item_count; /* number of result record from last query */
         void *priv;            /* opaque private data of the plugin */
@@ -26,7 +30,8 @@ extern "C" {
         int  (*query)    (dl_plugin_t self, const char *input);
         /* called before every main update loop */
         int  (*before_update) (dl_plugin_t self);
-        /* called when some events associated with this plugin happened */
+        /* called when some events associated with this plugin happened,
+         * return positive if nothing visible changed and no redraw is needed */
         int  (*update)   (dl_plugin_t self);
 
         /* access the content of record */
@@ -44,12 +49,51 @@ extern "C" {
     #define DL_FD_EVENT_WRITE  2
     #define DL_FD_EVENT_STATUS 4
 
-    /* monitor a file descriptor, once a event occurs, update() will be called */
-    /* return - a monitor id, further cancelling is in plan */
+    /* monitor a file descriptor until unregistered, once a event occurs,
+     * update() will be called; registering a fd again replaces the
+     * previous registration by the same plugin, a fd watched for
+     * anything else is refused */
+    /* return - a monitor id, or -1 on failure */
     int register_update_fd(dl_plugin_t plugin, int fd, int event);
+
+    /* called instead of update() for a monitored fd, return value as of update() */
+    typedef int (*dl_fd_callback_t)(dl_plugin_t self, int fd, int event, void *data);
+    int register_fd_callback(dl_plugin_t plugin, int fd, int event,
+                             dl_fd_callback_t callback, void *data);
+
+    /* stop monitoring, must be called before closing the fd; return -1
+     * if [id] is not monitored for [plugin] */
+    int unregister_update_fd(dl_plugin_t plugin, int id);
+
+    /* called when a timer expires, return value as of update() */
+    typedef int (*dl_timer_callback_t)(dl_plugin_t self, void *data);
+
+    /* only fire while the window is hidden, held back until then */
+    #define DL_TIMER_IDLE 1
+
+    /* call [callback] after [delay_ms], then every [interval_ms] if it
+     * is non-zero; callbacks of a plugin never run during its query */
+    /* return - a timer id, or -1 if not supported */
+    int register_timer(dl_plugin_t plugin, int delay_ms, int interval_ms, int flags,
+                       dl_timer_callback_t callback, void *data);
+    int unregister_timer(dl_plugin_t plugin, int id);
+
+    /* return the frecency of [text] as opened through [plugin]: how
+     * often and how recently it was, 0 if never; scores decay with
+     * time, so only compare the ones read during the same query */
+    /* callable from the query, a lookup costs O(1) */
+    double dl_frecency(dl_plugin_t plugin, const char *text);
     
+    /* implemented in query.c */
+
+    /* return non-zero if a newer input is waiting for the plugin, the
+     * running query may be given up since its result is dropped */
+    int dl_query_stale(dl_plugin_t plugin);
+
     /* implemented in plugin.c */
     int external_plugin_create(const char *name, const char *entry, const char *opt);
+    /* close the connection of [plugin] if it is an external one */
+    void external_plugin_close(dl_plugin_t plugin);
     
 #if __cplusplus
 }
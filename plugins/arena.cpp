@@ -0,0 +1,39 @@
+#include "arena.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+struct rec_less {
+    const vector<char> &buf;
+    template <typename R> bool operator()(const R &a, const R &b) const {
+        return strcmp(&buf[a.off], &buf[b.off]) < 0;
+    }
+};
+
+struct rec_equal {
+    const vector<char> &buf;
+    template <typename R> bool operator()(const R &a, const R &b) const {
+        return a.len == b.len && memcmp(&buf[a.off], &buf[b.off], a.len) == 0;
+    }
+};
+}
+
+void
+str_arena::sort_unique() {
+    rec_less less = { buf };
+    rec_equal equal = { buf };
+    sort(recs.begin(), recs.end(), less);
+    recs.erase(unique(recs.begin(), recs.end(), equal), recs.end());
+
+    // repack in sorted order so that scans walk the buffer linearly
+    vector<char> packed;
+    packed.reserve(buf.size());
+    for (size_t i = 0; i < recs.size(); ++ i) {
+        const char *s = &buf[recs[i].off];
+        recs[i].off = packed.size();
+        packed.insert(packed.end(), s, s + recs[i].len + 1);
+    }
+    buf.swap(packed);
+}
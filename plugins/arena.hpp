@@ -0,0 +1,49 @@
+#ifndef __DLAUNCHER_ARENA_HPP__
+#define __DLAUNCHER_ARENA_HPP__
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// A corpus of strings stored once, back to back in one buffer and NUL
+// terminated, addressed by index through offset/length records.
+// Pointers returned by get() stay valid until the arena is modified.
+class str_arena {
+public:
+    void clear() { buf.clear(); recs.clear(); }
+
+    unsigned int add(const char *s, size_t len) {
+        rec r = { (uint32_t)buf.size(), (uint32_t)len };
+        buf.insert(buf.end(), s, s + len);
+        buf.push_back(0);
+        recs.push_back(r);
+        return recs.size() - 1;
+    }
+    unsigned int add(const char *s) { return add(s, strlen(s)); }
+    unsigned int add(const std::string &s) { return add(s.c_str(), s.length()); }
+
+    const char  *get(unsigned int index) const { return &buf[recs[index].off]; }
+    unsigned int length(unsigned int index) const { return recs[index].len; }
+    unsigned int offset(unsigned int index) const { return recs[index].off; }
+    unsigned int size() const { return recs.size(); }
+
+    // the whole buffer, strings separated by NUL
+    const char  *data() const { return buf.empty() ? "" : &buf[0]; }
+    size_t       data_size() const { return buf.size(); }
+
+    // sort the strings with strcmp() and drop duplicates
+    void sort_unique();
+
+private:
+    struct rec {
+        uint32_t off;
+        uint32_t len;
+    };
+
+    std::vector<char> buf;
+    std::vector<rec>  recs;
+};
+
+#endif
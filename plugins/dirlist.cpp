@@ -3,6 +3,7 @@
 #include <spawn.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <cstdlib>
 #include <cstring>
 #include <cstdio>
 
@@ -134,7 +135,11 @@ dirlist(const string &dirname, vector<string> &r, const string &cache_file_prefi
         }
 
         // Using '\0' as the delimeter. We are using UTF-8 so no problem! +_+
-        FILE *f = fopen(cachename.c_str(), "wb");
+        // Plugins may list the same directory from several query threads,
+        // so write a private temporary file and move it in place
+        string tmpname = cachename + ".XXXXXX";
+        int fd = mkstemp(&tmpname[0]);
+        FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
         if (f != NULL) {
             write_utf8_string(CACHE_HEAD, f);
             for (int i = 0; i < r.size(); ++ i)
@@ -145,10 +150,16 @@ dirlist(const string &dirname, vector<string> &r, const string &cache_file_prefi
             struct utimbuf times;
             times.actime = dir_time;
             times.modtime = dir_time;
-            utime(cachename.c_str(), &times);
+            utime(tmpname.c_str(), &times);
+            if (rename(tmpname.c_str(), cachename.c_str()))
+                unlink(tmpname.c_str());
         }
         else
         {
+            if (fd >= 0) {
+                close(fd);
+                unlink(tmpname.c_str());
+            }
             fprintf(stderr, "Cannot open file %s as the dir list cache\n", cachename.c_str());
         }
     }
@@ -0,0 +1,48 @@
+#include "frecency.hpp"
+
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+struct hit_s {
+    double   score;
+    uint32_t pos;
+};
+
+bool
+operator<(const hit_s &a, const hit_s &b) {
+    // higher score first, then the original order
+    if (a.score != b.score) return a.score > b.score;
+    return a.pos < b.pos;
+}
+}
+
+void
+frecency_order(dl_plugin_t self, vector<uint32_t> &candidates,
+               match_get_fn get, void *ctx) {
+    vector<hit_s> hits;
+
+    for (uint32_t i = 0; i < candidates.size(); ++ i) {
+        double score = dl_frecency(self, get(ctx, candidates[i]));
+        if (score > 0) {
+            hit_s h = { score, i };
+            hits.push_back(h);
+        }
+    }
+    if (hits.empty()) return;
+
+    sort(hits.begin(), hits.end());
+
+    // the hits in front, then the rest in place
+    vector<uint32_t> ordered;
+    ordered.reserve(candidates.size());
+    for (size_t i = 0; i < hits.size(); ++ i) {
+        ordered.push_back(candidates[hits[i].pos]);
+        candidates[hits[i].pos] = (uint32_t)-1;
+    }
+    for (size_t i = 0; i < candidates.size(); ++ i)
+        if (candidates[i] != (uint32_t)-1) ordered.push_back(candidates[i]);
+    candidates.swap(ordered);
+}
@@ -0,0 +1,15 @@
+#ifndef __DLAUNCHER_FRECENCY_HPP__
+#define __DLAUNCHER_FRECENCY_HPP__
+
+#include "../match.h"
+#include "../plugin.h"
+
+#include <stdint.h>
+#include <vector>
+
+// move the candidates opened before to the front, most frecent first;
+// the others keep their order
+void frecency_order(dl_plugin_t self, std::vector<uint32_t> &candidates,
+                    match_get_fn get, void *ctx);
+
+#endif
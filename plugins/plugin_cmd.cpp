@@ -1,8 +1,12 @@
 #include "../defaults.h"
+#include "../match.h"
 #include "../plugin.h"
 
+#include "arena.hpp"
 #include "dirlist.hpp"
 #include "exec.hpp"
+#include "frecency.hpp"
+#include "suffix_array.hpp"
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -18,35 +22,57 @@
 
 using namespace std;
 
+namespace {
 struct priv_s {
-    vector<string> candidates;
+    vector<uint32_t> candidates;
+    match_refine_s refine;
+    // exact hits from the index
+    vector<uint32_t> prefix;
+    vector<uint32_t> contain;
+    vector<match_rank_s> rank;
 };
-
-static bool
-cmpString(const string &a, const string &b)
-{
-    return strcmp(a.c_str(), b.c_str()) < 0;
 }
 
+#define CACHE_REFRESH_MS 10000
+
+static int refresh_timer = -1;
 static int init_flag = 0;
 static time_t cache_timestamp;
-static vector<string> cache;
+static str_arena cache;
+static suffix_array cache_index;
+// PATH and the mtimes of its directories when the cache was built
+static string cache_path;
+static vector<time_t> cache_mtime;
+
+// return the mtimes of the directories in [path]
+static vector<time_t>
+path_mtimes(const string &path) {
+    vector<time_t> r;
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find(':', start);
+        if (end == string::npos) end = path.size();
+        struct stat statbuf;
+        r.push_back(stat(path.substr(start, end - start).c_str(), &statbuf) ? 0 : statbuf.st_mtime);
+        start = end + 1;
+    }
+    return r;
+}
 
-static void _init(dl_plugin_t self) { }
+static const char *
+_get(void *ctx, unsigned int index) {
+    return cache.get(index);
+}
 
 static void
-update_cache(void) {
-    time_t nts;
-    time(&nts);
-
-    if (init_flag == 1 && difftime(nts, cache_timestamp) <= 10)
-        return;
-    init_flag = 1;
-    cache_timestamp = nts;
-
+build_cache(match_refine_t refine) {
     cache.clear();
 
-    char *path = strdup(getenv("PATH"));
+    const char *env = getenv("PATH");
+    cache_path  = env ? env : "";
+    cache_mtime = path_mtimes(cache_path);
+
+    char *path = strdup(cache_path.c_str());
     char *dir = path, *nextdir;
     vector<string> comp;
         
@@ -71,7 +97,7 @@ update_cache(void) {
                 if (!(statbuf.st_mode & 0111)) continue;
                 // a regular and executable item now
 
-                cache.push_back(comp[i]);
+                cache.add(comp[i]);
             }
         }
 
@@ -80,34 +106,88 @@ update_cache(void) {
 
     free(path);
 
-    sort(cache.begin(), cache.end(), cmpString);
-    vector<string>::iterator it =
-        unique(cache.begin(), cache.end());
-    cache.resize(distance(cache.begin(), it));
+    cache.sort_unique();
+    cache_index.build(cache);
+
+    match_refine_reset(refine, cache.size());
 }
 
-static int _query(dl_plugin_t self, const char *input) {
-    update_cache();
+// without timers, rebuild on the first query after the timeout
+static void
+update_cache(match_refine_t refine) {
+    time_t nts;
+    time(&nts);
+
+    if (init_flag == 1 && difftime(nts, cache_timestamp) * 1000 <= CACHE_REFRESH_MS)
+        return;
+    init_flag = 1;
+    cache_timestamp = nts;
+
+    build_cache(refine);
+}
+
+static int
+_refresh(dl_plugin_t self, void *data) {
     priv_s *p = (priv_s *)self->priv;
-    
-    vector<string> comp_prefix, comp_contain;
-        
-    for (int i = 0; i < cache.size(); ++ i) {
-        size_t idx = cache[i].find(input);
-        if (idx == 0)
-            comp_prefix.push_back(cache[i]);
-        else if (idx != string::npos)
-            comp_contain.push_back(cache[i]);
-    }
+    // a few stat() calls, the rebuild lists and stats every executable
+    const char *env = getenv("PATH");
+    string path = env ? env : "";
+    if (path == cache_path && path_mtimes(path) == cache_mtime)
+        return 1;
+    build_cache(&p->refine);
+    // the window is hidden, nothing to redraw
+    return 1;
+}
 
-    sort(comp_prefix.begin(), comp_prefix.end(), cmpString);
-    sort(comp_contain.begin(), comp_contain.end(), cmpString);
+static void
+_init(dl_plugin_t self) {
+    priv_s *p = (priv_s *)self->priv;
+    // refresh the cache in the background while the window is hidden
+    refresh_timer = register_timer(self, CACHE_REFRESH_MS, CACHE_REFRESH_MS,
+                                   DL_TIMER_IDLE, &_refresh, NULL);
+    if (refresh_timer >= 0) build_cache(&p->refine);
+}
+
+static int _query(dl_plugin_t self, const char *input) {
+    priv_s *p = (priv_s *)self->priv;
+    if (refresh_timer < 0) update_cache(&p->refine);
 
     p->candidates.clear();
 
-    // put the suggestion as first element
-    p->candidates.insert(p->candidates.end(), comp_prefix.begin(), comp_prefix.end());
-    p->candidates.insert(p->candidates.end(), comp_contain.begin(), comp_contain.end());
+    if (*input && !match_icase) {
+        // names containing the input, from the index; prefix hits first
+        cache_index.find(cache, input, p->prefix, p->contain);
+        p->candidates.insert(p->candidates.end(), p->prefix.begin(), p->prefix.end());
+
+        p->rank.resize(p->contain.size());
+        for (unsigned int i = 0; i < p->contain.size(); ++ i) {
+            p->rank[i].index = p->contain[i];
+            p->rank[i].score = match_fuzzy(cache.get(p->contain[i]), input);
+        }
+        match_topk(p->rank.data(), p->rank.size(), MATCH_TOPK);
+        for (unsigned int i = 0; i < p->rank.size(); ++ i)
+            p->candidates.push_back(p->rank[i].index);
+
+        // enough exact hits to fill the visible pages, skip fuzzy matching;
+        // also skip it when the input has changed since
+        if (p->candidates.size() >= MATCH_TOPK || dl_query_stale(self)) {
+            frecency_order(self, p->candidates, &_get, NULL);
+            self->item_count = p->candidates.size();
+            return 0;
+        }
+    }
+
+    const match_rank_s *rank;
+    unsigned int count;
+    match_query(&p->refine, input, &_get, NULL, &rank, &count);
+
+    for (unsigned int i = 0; i < count; ++ i) {
+        if (*input && !match_icase && cache_index.found(rank[i].index))
+            continue;
+        p->candidates.push_back(rank[i].index);
+    }
+    // what is opened most sorts first
+    frecency_order(self, p->candidates, &_get, NULL);
 
     self->item_count = p->candidates.size();
     return 0;
@@ -115,20 +195,20 @@ static int _query(dl_plugin_t self, const char *input) {
 
 static int _get_desc(dl_plugin_t self, unsigned int index, const char **output_ptr) {
     priv_s *p = (priv_s *)self->priv;
-    *output_ptr = p->candidates[index].c_str();
+    *output_ptr = cache.get(p->candidates[index]);
     return 0;
 }
 
 static int _get_text(dl_plugin_t self, unsigned int index, const char **output_ptr) {
     priv_s *p = (priv_s *)self->priv;
-    *output_ptr = p->candidates[index].c_str();
+    *output_ptr = cache.get(p->candidates[index]);
     return 0;
 }
 
 static int _open(dl_plugin_t self, int index, const char *input, int mode) {
     priv_s *p = (priv_s *)self->priv;
     if (index >= 0 && index < p->candidates.size())
-        input = p->candidates[index].c_str();
+        input = cache.get(p->candidates[index]);
     vector<string> args;
     if (mode) {
         args.push_back(DEFAULT_TERM);
@@ -142,7 +222,9 @@ static int _open(dl_plugin_t self, int index, const char *input, int mode) {
 static dl_plugin_s _self;
 
 static __attribute__((constructor)) void _register(void) {
-    _self.priv       = new priv_s();
+    priv_s *p        = new priv_s();
+    match_refine_init(&p->refine);
+    _self.priv       = p;
     _self.name       = "cmd";
     _self.priority   = 50;
     _self.hist       = 1;
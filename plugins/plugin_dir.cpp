@@ -2,9 +2,12 @@
 #define _XOPEN_SOURCE 700
 #endif
 
+#include "arena.hpp"
 #include "dirlist.hpp"
 #include "exec.hpp"
+#include "frecency.hpp"
 
+#include "../match.h"
 #include "../plugin.h"
 #include "../defaults.h"
 
@@ -22,21 +25,72 @@
 
 using namespace std;
 
+namespace {
 struct priv_s {
-    vector<string> candidates;
+    vector<uint32_t> candidates;
+    // listing of the last queried directory
+    string         base_dir;
+    time_t         base_time;
+    str_arena      cache;
+    match_refine_s refine;
 };
+}
+
+static void _init(dl_plugin_t self) { }
 
-static bool
-cmpString(const string &a, const string &b)
-{
-    return strcmp(a.c_str(), b.c_str()) < 0;
+static const char *
+_get(void *ctx, unsigned int index) {
+    priv_s *p = (priv_s *)ctx;
+    return p->cache.get(index);
 }
 
-static int init_flag = 0;
-static time_t cache_timestamp;
-static vector<string> cache;
+// return -1 if given up for a newer input
+static int
+update_cache(dl_plugin_t self, priv_s *p, const char *base_dir, const char *home, int home_len) {
+    struct stat statbuf;
+    const char *dir = base_dir[0] ? base_dir : "/";
 
-static void _init(dl_plugin_t self) { }
+    if (stat(dir, &statbuf)) statbuf.st_mtime = 0;
+    if (p->base_dir == base_dir && p->base_time == statbuf.st_mtime)
+        return 0;
+
+    p->base_dir  = base_dir;
+    p->base_time = statbuf.st_mtime;
+    p->cache.clear();
+
+    vector<string> comp;
+
+    int r = dirlist(dir, comp, "/tmp/dircache_");
+    if (r == 0)
+    {
+        for (int i = 0; i < comp.size(); ++ i) {
+            // stat() may be slow on remote file systems
+            if ((i & 63) == 63 && dl_query_stale(self)) {
+                p->base_dir.clear();
+                p->base_time = (time_t)-1;
+                p->cache.clear();
+                match_refine_reset(&p->refine, 0);
+                return -1;
+            }
+            ostringstream oss;
+            // skip dot files
+            if (comp[i].c_str()[0] == '.') continue;
+            oss << base_dir << "/" << comp[i];
+            string filename = oss.str();
+            if (stat(filename.c_str(), &statbuf)) continue;
+            if (!S_ISDIR(statbuf.st_mode)) continue;
+            // only directory
+            if (strncmp(filename.c_str(), home, home_len) == 0 && home_len < filename.length()) {
+                // remove $HOME prefix
+                p->cache.add(filename.c_str() + home_len + 1);
+            } else p->cache.add(filename);
+        }
+    }
+
+    p->cache.sort_unique();
+    match_refine_reset(&p->refine, p->cache.size());
+    return 0;
+}
 
 static int _query(dl_plugin_t self, const char *input) {
     priv_s *p = (priv_s *)self->priv;
@@ -61,52 +115,25 @@ static int _query(dl_plugin_t self, const char *input) {
         -- len;
     }
 
-    vector<string> cache;
-    vector<string> comp;
-
-    int r = dirlist(base_dir[0] ? base_dir : "/", comp, "/tmp/dircache_");
-    struct stat statbuf;
-    if (r == 0)
-    {
-        for (int i = 0; i < comp.size(); ++ i) {
-            ostringstream oss;
-            // skip dot files
-            if (comp[i].c_str()[0] == '.') continue;
-            oss << base_dir << "/" << comp[i];
-            string filename = oss.str();
-            if (stat(filename.c_str(), &statbuf)) continue;
-            if (!S_ISDIR(statbuf.st_mode)) continue;
-            // only directory
-            if (strncmp(filename.c_str(), home, home_len) == 0 && home_len < filename.length()) {
-                // remove $HOME prefix
-                cache.push_back(filename.c_str() + home_len + 1);
-            } else cache.push_back(filename);
-        }
-    }
-
+    int r = update_cache(self, p, base_dir, home, home_len);
     free(base_dir);
-    
-    vector<string> comp_prefix, comp_contain;
+    if (r) {
+        p->candidates.clear();
+        self->item_count = 0;
+        return 0;
+    }
 
     if (strncmp(input, home, home_len) == 0 && home_len < strlen(input))
         input += home_len + 1;
 
-    for (int i = 0; i < cache.size(); ++ i) {
-        size_t idx = cache[i].find(input);
-        if (idx == 0)
-            comp_prefix.push_back(cache[i]);
-        else if (idx != string::npos)
-            comp_contain.push_back(cache[i]);
-    }
-
-    sort(comp_prefix.begin(), comp_prefix.end(), cmpString);
-    sort(comp_contain.begin(), comp_contain.end(), cmpString);
+    const match_rank_s *rank;
+    unsigned int count;
+    match_query(&p->refine, input, &_get, p, &rank, &count);
 
     p->candidates.clear();
-
-    // put the suggestion as first element
-    p->candidates.insert(p->candidates.end(), comp_prefix.begin(), comp_prefix.end());
-    p->candidates.insert(p->candidates.end(), comp_contain.begin(), comp_contain.end());
+    for (unsigned int i = 0; i < count; ++ i)
+        p->candidates.push_back(rank[i].index);
+    frecency_order(self, p->candidates, &_get, p);
 
     self->item_count = p->candidates.size();
     return 0;
@@ -114,13 +141,13 @@ static int _query(dl_plugin_t self, const char *input) {
 
 static int _get_desc(dl_plugin_t self, unsigned int index, const char **output_ptr) {
     priv_s *p = (priv_s *)self->priv;
-    *output_ptr = p->candidates[index].c_str();
+    *output_ptr = p->cache.get(p->candidates[index]);
     return 0;
 }
 
 static int _get_text(dl_plugin_t self, unsigned int index, const char **output_ptr) {
     priv_s *p = (priv_s *)self->priv;
-    *output_ptr = p->candidates[index].c_str();
+    *output_ptr = p->cache.get(p->candidates[index]);
     return 0;
 }
 
@@ -129,7 +156,7 @@ static int _open(dl_plugin_t self, int index, const char *input, int mode) {
     vector<string> args;
     
     if (index >= 0 && index < p->candidates.size())
-        input = p->candidates[index].c_str();
+        input = p->cache.get(p->candidates[index]);
 
     char *path;
     if (input[0] != '/') {
@@ -148,7 +175,10 @@ static int _open(dl_plugin_t self, int index, const char *input, int mode) {
 static dl_plugin_s _self;
 
 static __attribute__((constructor)) void _register(void) {
-    _self.priv       = new priv_s();
+    priv_s *p        = new priv_s();
+    p->base_time     = 0;
+    match_refine_init(&p->refine);
+    _self.priv       = p;
     _self.name       = "dir";
     _self.priority   = 40;
     _self.hist       = 1;
@@ -2,11 +2,14 @@
 #define _WITH_GETLINE
 #endif
 
+#include "../match.h"
 #include "../plugin.h"
 #include "../defaults.h"
 
+#include "arena.hpp"
 #include "dirlist.hpp"
 #include "exec.hpp"
+#include "frecency.hpp"
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -22,36 +25,40 @@
 
 using namespace std;
 
+namespace {
 struct priv_s {
-    vector<string> candidates;
+    vector<uint32_t> candidates;
+    match_refine_s refine;
 };
-
-static bool
-cmpString(const string &a, const string &b)
-{
-    return strcmp(a.c_str(), b.c_str()) < 0;
 }
 
-static void _init(dl_plugin_t self) { }
+#define CACHE_REFRESH_MS 10000
 
+static int refresh_timer = -1;
 static int init_flag = 0;
 static time_t cache_timestamp;
-static vector<string> cache;
-
-static void
-update_cache(void) {
-    time_t nts;
-    time(&nts);
+static str_arena cache;
+// mtime of ~/.ssh/config when the cache was built, 0 if missing
+static time_t config_mtime;
+
+static time_t
+get_config_mtime(const char *path) {
+    struct stat statbuf;
+    return stat(path, &statbuf) ? 0 : statbuf.st_mtime;
+}
 
-    if (init_flag == 1 && difftime(nts, cache_timestamp) <= 10)
-        return;
-    init_flag = 1;
-    cache_timestamp = nts;
+static const char *
+_get(void *ctx, unsigned int index) {
+    return cache.get(index);
+}
 
+static void
+build_cache(match_refine_t refine) {
     cache.clear();
 
     char *path;
     asprintf(&path, "%s/.ssh/config", getenv("HOME"));
+    config_mtime = get_config_mtime(path);
     FILE *ssh_config = fopen(path, "r");
 
     if (ssh_config) {
@@ -77,8 +84,7 @@ update_cache(void) {
                     char ec = line[e];
 
                     if (!skip && e != s) {
-                        line[e] = 0;
-                        cache.push_back(line + s);
+                        cache.add(line + s, e - s);
                     }
                     
                     if (ec == 0 || ec == '\n') break;
@@ -93,35 +99,60 @@ update_cache(void) {
 
     free(path);
 
-    sort(cache.begin(), cache.end(), cmpString);
-    vector<string>::iterator it =
-        unique(cache.begin(), cache.end());
-    cache.resize(distance(cache.begin(), it));
+    cache.sort_unique();
+
+    match_refine_reset(refine, cache.size());
+}
+
+// without timers, rebuild on the first query after the timeout
+static void
+update_cache(match_refine_t refine) {
+    time_t nts;
+    time(&nts);
+
+    if (init_flag == 1 && difftime(nts, cache_timestamp) * 1000 <= CACHE_REFRESH_MS)
+        return;
+    init_flag = 1;
+    cache_timestamp = nts;
+
+    build_cache(refine);
+}
+
+static int
+_refresh(dl_plugin_t self, void *data) {
+    priv_s *p = (priv_s *)self->priv;
+    char *path;
+    if (asprintf(&path, "%s/.ssh/config", getenv("HOME")) < 0) return 1;
+    time_t mtime = get_config_mtime(path);
+    free(path);
+    if (mtime == config_mtime) return 1;
+    build_cache(&p->refine);
+    // the window is hidden, nothing to redraw
+    return 1;
+}
+
+static void
+_init(dl_plugin_t self) {
+    priv_s *p = (priv_s *)self->priv;
+    // refresh the cache in the background while the window is hidden
+    refresh_timer = register_timer(self, CACHE_REFRESH_MS, CACHE_REFRESH_MS,
+                                   DL_TIMER_IDLE, &_refresh, NULL);
+    if (refresh_timer >= 0) build_cache(&p->refine);
 }
 
 static int
 _query(dl_plugin_t self, const char *input) {
-    update_cache();
     priv_s *p = (priv_s *)self->priv;
-    
-    vector<string> comp_prefix, comp_contain;
-        
-    for (int i = 0; i < cache.size(); ++ i) {
-        size_t idx = cache[i].find(input);
-        if (idx == 0)
-            comp_prefix.push_back(cache[i]);
-        else if (idx != string::npos)
-            comp_contain.push_back(cache[i]);
-    }
+    if (refresh_timer < 0) update_cache(&p->refine);
 
-    sort(comp_prefix.begin(), comp_prefix.end(), cmpString);
-    sort(comp_contain.begin(), comp_contain.end(), cmpString);
+    const match_rank_s *rank;
+    unsigned int count;
+    match_query(&p->refine, input, &_get, NULL, &rank, &count);
 
     p->candidates.clear();
-
-    // put the suggestion as first element
-    p->candidates.insert(p->candidates.end(), comp_prefix.begin(), comp_prefix.end());
-    p->candidates.insert(p->candidates.end(), comp_contain.begin(), comp_contain.end());
+    for (unsigned int i = 0; i < count; ++ i)
+        p->candidates.push_back(rank[i].index);
+    frecency_order(self, p->candidates, &_get, NULL);
 
     self->item_count = p->candidates.size();
     return 0;
@@ -129,20 +160,20 @@ _query(dl_plugin_t self, const char *input) {
 
 static int _get_desc(dl_plugin_t self, unsigned int index, const char **output_ptr) {
     priv_s *p = (priv_s *)self->priv;
-    *output_ptr = p->candidates[index].c_str();
+    *output_ptr = cache.get(p->candidates[index]);
     return 0;
 }
 
 static int _get_text(dl_plugin_t self, unsigned int index, const char **output_ptr) {
     priv_s *p = (priv_s *)self->priv;
-    *output_ptr = p->candidates[index].c_str();
+    *output_ptr = cache.get(p->candidates[index]);
     return 0;
 }
 
 static int _open(dl_plugin_t self, int index, const char *input, int mode) {
     priv_s *p = (priv_s *)self->priv;
     if (index >= 0 && index < p->candidates.size())
-        input = p->candidates[index].c_str();
+        input = cache.get(p->candidates[index]);
 
     vector<string> args;
     // use urxvt here
@@ -157,7 +188,9 @@ static int _open(dl_plugin_t self, int index, const char *input, int mode) {
 static dl_plugin_s _self;
 
 static __attribute__((constructor)) void _register(void) {
-    _self.priv       = new priv_s();
+    priv_s *p        = new priv_s();
+    match_refine_init(&p->refine);
+    _self.priv       = p;
     _self.name       = "ssh";
     _self.priority   = 80;
     _self.hist       = 1;
@@ -0,0 +1,85 @@
+#include "suffix_array.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+struct suffix_less {
+    const char *buf;
+    bool operator()(uint32_t a, uint32_t b) const {
+        int r = strcmp(buf + a, buf + b);
+        return r < 0 || (r == 0 && a < b);
+    }
+};
+
+// compare a suffix with the pattern, up to the pattern length
+struct pattern_less {
+    const char *buf;
+    size_t      len;
+    bool operator()(uint32_t a, const char *p) const {
+        return strncmp(buf + a, p, len) < 0;
+    }
+    bool operator()(const char *p, uint32_t a) const {
+        return strncmp(p, buf + a, len) < 0;
+    }
+};
+}
+
+void
+suffix_array::build(const str_arena &arena) {
+    const char *buf = arena.data();
+    size_t size = arena.data_size();
+
+    sa.clear();
+    for (size_t i = 0; i < size; ++ i)
+        if (buf[i]) sa.push_back(i);
+
+    suffix_less less = { buf };
+    sort(sa.begin(), sa.end(), less);
+
+    stamp.assign(arena.size(), 0);
+    query = 0;
+}
+
+void
+suffix_array::find(const str_arena &arena, const char *pattern,
+                   vector<uint32_t> &prefix, vector<uint32_t> &contain) {
+    pattern_less less = { arena.data(), strlen(pattern) };
+    pair<vector<uint32_t>::const_iterator, vector<uint32_t>::const_iterator> range =
+        equal_range(sa.begin(), sa.end(), pattern, less);
+
+    prefix.clear();
+    contain.clear();
+    if (stamp.size() != arena.size()) return;
+
+    if (++ query == 0) {
+        stamp.assign(stamp.size(), 0);
+        query = 1;
+    }
+
+    // the string owning each suffix, offsets grow with the index
+    hits.clear();
+    for (vector<uint32_t>::const_iterator it = range.first; it != range.second; ++ it) {
+        unsigned int lo = 0, hi = arena.size();
+        while (hi - lo > 1) {
+            unsigned int mid = (lo + hi) / 2;
+            if (arena.offset(mid) <= *it) lo = mid;
+            else hi = mid;
+        }
+        hits.push_back(lo);
+        // suffixes starting a string come in the order of the strings
+        if (arena.offset(lo) == *it) {
+            stamp[lo] = query;
+            prefix.push_back(lo);
+        }
+    }
+
+    for (size_t i = 0; i < hits.size(); ++ i) {
+        if (stamp[hits[i]] == query) continue;
+        stamp[hits[i]] = query;
+        contain.push_back(hits[i]);
+    }
+}
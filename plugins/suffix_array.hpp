@@ -0,0 +1,34 @@
+#ifndef __DLAUNCHER_SUFFIX_ARRAY_HPP__
+#define __DLAUNCHER_SUFFIX_ARRAY_HPP__
+
+#include "arena.hpp"
+
+#include <stdint.h>
+
+#include <vector>
+
+// Suffix array over all strings of an arena. The arena buffer is the
+// concatenation of its strings separated by NUL, so every suffix ends
+// at the end of the string it starts in. Strings containing a pattern
+// are found by two binary searches instead of a scan of the corpus.
+// The arena is expected to be packed in index order (see sort_unique).
+class suffix_array {
+public:
+    void build(const str_arena &arena);
+    void clear() { sa.clear(); stamp.clear(); }
+
+    // collect the strings containing [pattern], each once; the ones
+    // starting with it go to [prefix] in index order, others to [contain]
+    void find(const str_arena &arena, const char *pattern,
+              std::vector<uint32_t> &prefix, std::vector<uint32_t> &contain);
+    // whether the string [index] was collected by the last find()
+    bool found(uint32_t index) const { return index < stamp.size() && stamp[index] == query; }
+
+private:
+    std::vector<uint32_t> sa;     // suffix offsets, lexicographic order
+    std::vector<uint32_t> stamp;  // per string, last query it was found in
+    std::vector<uint32_t> hits;
+    uint32_t              query;
+};
+
+#endif
@@ -0,0 +1,292 @@
+#define _GNU_SOURCE
+
+#include "query.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define QUERY_THREAD_MAX 8
+
+typedef struct query_slot_s {
+    dl_plugin_t plugin;
+    int         busy;       /* queued or running */
+    int         running;
+    char       *input;      /* input of the queued or running query */
+    unsigned    gen;
+    char       *next;       /* newer input waiting for the running query */
+    unsigned    next_gen;
+    int         delayed;    /* debounced, not queued before [due] */
+    struct timespec due;
+    int         ret;
+} query_slot_s;
+
+/* both conditions wait on CLOCK_MONOTONIC, see query_init() */
+static pthread_mutex_t query_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  query_job;
+static pthread_cond_t  query_done;
+
+static query_slot_s *slots;
+static int           slot_count;
+static int          *queue;       /* ring of slot ids */
+static int           queue_head, queue_size;
+static int           busy_count;
+static int           delayed_count;
+static int           notify_fd[2] = { -1, -1 };
+
+static void
+_push(int id) {
+    queue[(queue_head + queue_size ++) % slot_count] = id;
+    pthread_cond_signal(&query_job);
+}
+
+static void
+_deadline(struct timespec *ts, int ms) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec  += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ++ ts->tv_sec;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static int
+_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec ||
+        (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* hold back the query of a plugin until its input settles */
+static void
+_delay(query_slot_s *s) {
+    if (!s->delayed) ++ delayed_count;
+    s->delayed = 1;
+    _deadline(&s->due, s->plugin->debounce);
+    pthread_cond_signal(&query_job);
+}
+
+/* queue the delayed slots that are due, or all of them if [all]; return
+ * non-zero and set [next] to the earliest due time of the remaining */
+static int
+_promote(int all, struct timespec *next) {
+    struct timespec now;
+    int i, r = 0;
+
+    if (delayed_count == 0) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < slot_count; ++ i) {
+        query_slot_s *s = &slots[i];
+        if (!s->delayed) continue;
+        if (all || !_before(&now, &s->due)) {
+            s->delayed = 0;
+            -- delayed_count;
+            _push(i);
+        } else if (!r || _before(&s->due, next)) {
+            *next = s->due;
+            r = 1;
+        }
+    }
+    return r;
+}
+
+static void *
+_worker(void *arg) {
+    struct timespec next;
+
+    (void)arg;
+    pthread_mutex_lock(&query_lock);
+    while (1) {
+        while (1) {
+            int delayed = _promote(0, &next);
+            if (queue_size > 0) break;
+            if (delayed)
+                pthread_cond_timedwait(&query_job, &query_lock, &next);
+            else pthread_cond_wait(&query_job, &query_lock);
+        }
+        query_slot_s *s = &slots[queue[queue_head]];
+        queue_head = (queue_head + 1) % slot_count;
+        -- queue_size;
+
+        s->running = 1;
+        s->plugin->generation = s->gen;
+        pthread_mutex_unlock(&query_lock);
+        int ret = s->plugin->query(s->plugin, s->input);
+        pthread_mutex_lock(&query_lock);
+        s->running = 0;
+        s->ret = ret;
+
+        free(s->input);
+        s->input = NULL;
+        if (s->next) {
+            /* the input changed meanwhile, run again right away */
+            s->input = s->next;
+            s->gen   = s->next_gen;
+            s->next  = NULL;
+            if (s->plugin->debounce > 0) _delay(s);
+            else _push(s - slots);
+            continue;
+        }
+
+        s->busy = 0;
+        -- busy_count;
+        pthread_cond_broadcast(&query_done);
+        char c = 0;
+        if (write(notify_fd[1], &c, 1) < 0 && errno != EAGAIN)
+            perror("query notify");
+    }
+    return NULL;
+}
+
+int
+query_init(int nplugin) {
+    pthread_condattr_t attr;
+    int i, n;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&query_job, &attr);
+    pthread_cond_init(&query_done, &attr);
+    pthread_condattr_destroy(&attr);
+
+    slots = (query_slot_s *)calloc(nplugin, sizeof(query_slot_s));
+    queue = (int *)malloc(sizeof(int) * nplugin);
+    if (!slots || !queue) return -1;
+    slot_count = nplugin;
+
+    if (pipe2(notify_fd, O_CLOEXEC | O_NONBLOCK)) return -1;
+
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > nplugin) n = nplugin;
+    if (n > QUERY_THREAD_MAX) n = QUERY_THREAD_MAX;
+    if (n < 1) n = 1;
+
+    for (i = 0; i < n; ++ i) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, &_worker, NULL)) return -1;
+        pthread_detach(t);
+    }
+    return 0;
+}
+
+int
+query_notify_fd(void) {
+    return notify_fd[0];
+}
+
+int
+query_collect(void) {
+    char buf[64];
+    int r = 0;
+    while (read(notify_fd[0], buf, sizeof(buf)) > 0) r = 1;
+    return r;
+}
+
+void
+query_submit(dl_plugin_t plugin, unsigned int generation, const char *input) {
+    query_slot_s *s = &slots[plugin->id];
+    char *dup = strdup(input);
+    if (!dup) return;
+
+    pthread_mutex_lock(&query_lock);
+    s->plugin = plugin;
+    if (!s->busy) {
+        s->busy  = 1;
+        s->input = dup;
+        s->gen   = generation;
+        ++ busy_count;
+        if (plugin->debounce > 0) _delay(s);
+        else _push(plugin->id);
+    } else if (!s->running) {
+        /* still in the queue, just replace the input */
+        free(s->input);
+        s->input = dup;
+        s->gen   = generation;
+        if (s->delayed) _delay(s);
+    } else {
+        free(s->next);
+        s->next     = dup;
+        s->next_gen = generation;
+    }
+    pthread_mutex_unlock(&query_lock);
+}
+
+int
+query_wait(int timeout_ms) {
+    struct timespec ts, next;
+    int r;
+
+    _deadline(&ts, timeout_ms);
+
+    pthread_mutex_lock(&query_lock);
+    /* debounced plugins are not waited for, unless waiting for ever */
+    while (busy_count > (timeout_ms < 0 ? 0 : delayed_count)) {
+        if (timeout_ms < 0) {
+            _promote(1, &next);
+            pthread_cond_wait(&query_done, &query_lock);
+        } else if (pthread_cond_timedwait(&query_done, &query_lock, &ts) == ETIMEDOUT)
+            break;
+    }
+    r = busy_count;
+    pthread_mutex_unlock(&query_lock);
+    return r;
+}
+
+int
+query_wait_plugin(dl_plugin_t plugin, int timeout_ms) {
+    struct timespec ts;
+    query_slot_s *s;
+    int r;
+
+    if (plugin->id < 0) return 0;
+    s = &slots[plugin->id];
+    _deadline(&ts, timeout_ms);
+
+    pthread_mutex_lock(&query_lock);
+    if (s->delayed) {
+        s->delayed = 0;
+        -- delayed_count;
+        _push(plugin->id);
+    }
+    while (s->busy)
+        if (pthread_cond_timedwait(&query_done, &query_lock, &ts) == ETIMEDOUT)
+            break;
+    r = s->busy;
+    pthread_mutex_unlock(&query_lock);
+    return r;
+}
+
+int
+query_busy(dl_plugin_t plugin) {
+    int r;
+    if (plugin->id < 0) return 0;
+    pthread_mutex_lock(&query_lock);
+    r = slots[plugin->id].busy;
+    pthread_mutex_unlock(&query_lock);
+    return r;
+}
+
+int
+query_result(dl_plugin_t plugin) {
+    int r;
+    if (plugin->id < 0) return 0;
+    pthread_mutex_lock(&query_lock);
+    r = slots[plugin->id].ret;
+    pthread_mutex_unlock(&query_lock);
+    return r;
+}
+
+int
+dl_query_stale(dl_plugin_t plugin) {
+    int r;
+    if (plugin->id < 0 || !slots) return 0;
+    pthread_mutex_lock(&query_lock);
+    r = slots[plugin->id].next != NULL;
+    pthread_mutex_unlock(&query_lock);
+    return r;
+}
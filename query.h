@@ -0,0 +1,37 @@
+#ifndef __DLAUNCHER_QUERY_H__
+#define __DLAUNCHER_QUERY_H__
+
+#include "plugin.h"
+
+/* parallel plugin queries
+ *
+ * Queries are run by a pool of worker threads, at most one at a time
+ * per plugin. Submitting a new input while the plugin is still busy
+ * replaces the queued one, so a plugin is never more than one input
+ * behind, and the result of a superseded input is dropped without
+ * notifying. The query of a plugin with a debounce time is held back
+ * until the input has not changed for that long; it is busy meanwhile.
+ * A plugin's results must not be accessed while it is busy.
+ * Each finished query writes a byte to the notify fd, so late results
+ * wake up the main loop.
+ */
+
+int  query_init(int nplugin);
+int  query_notify_fd(void);
+/* drain the notify fd, return non-zero if any query finished */
+int  query_collect(void);
+
+/* [generation] tags the input, see dl_plugin_s */
+void query_submit(dl_plugin_t plugin, unsigned int generation, const char *input);
+/* wait until no query is busy or [timeout_ms] passed (-1 for ever),
+ * return the number of plugins still busy; debounced queries are only
+ * waited for, and started right away, when waiting for ever */
+int  query_wait(int timeout_ms);
+/* wait until [plugin] is not busy or [timeout_ms] passed, its debounced
+ * query is started right away; return non-zero if still busy */
+int  query_wait_plugin(dl_plugin_t plugin, int timeout_ms);
+int  query_busy(dl_plugin_t plugin);
+/* return value of the last finished query of the plugin */
+int  query_result(dl_plugin_t plugin);
+
+#endif
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+
+#include "reactor.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#define REACTOR_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#define REACTOR_BATCH 64
+
+typedef struct reactor_entry_s {
+    int        used;
+    int        events;
+    int        suspended;
+    reactor_fn fn;
+    void      *ctx;
+} reactor_entry_s;
+
+/* recursive, held while calling back so that a registration is never
+ * removed under its callback by another thread */
+static pthread_mutex_t  reactor_lock;
+static reactor_entry_s *entries;      /* indexed by fd */
+static int              entry_alloc;
+static int              suspended_count;
+
+#ifdef REACTOR_EPOLL
+
+static int epfd = -1;
+
+static int
+_ctl(int op, int fd, int events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    if (events & REACTOR_READ)   ev.events |= EPOLLIN;
+    if (events & REACTOR_WRITE)  ev.events |= EPOLLOUT;
+    if (events & REACTOR_STATUS) ev.events |= EPOLLPRI;
+    ev.data.fd = fd;
+    return epoll_ctl(epfd, op, fd, &ev);
+}
+
+#else
+
+/* the poll set is rebuilt from the entries when they changed */
+static struct pollfd *pfds;
+static int            pfd_alloc;
+static int            pfd_dirty = 1;
+
+static int
+_ctl(int op, int fd, int events) {
+    pfd_dirty = 1;
+    return 0;
+}
+
+#endif
+
+static int
+_reserve(int fd) {
+    if (fd < 0) return -1;
+    if (fd < entry_alloc) return 0;
+    int alloc = entry_alloc ? entry_alloc : 64;
+    while (alloc <= fd) alloc <<= 1;
+    reactor_entry_s *e = (reactor_entry_s *)realloc(entries, sizeof(reactor_entry_s) * alloc);
+    if (!e) return -1;
+    memset(e + entry_alloc, 0, sizeof(reactor_entry_s) * (alloc - entry_alloc));
+    entries = e;
+    entry_alloc = alloc;
+    return 0;
+}
+
+int
+reactor_init(void) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&reactor_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+#ifdef REACTOR_EPOLL
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) return -1;
+#endif
+    return 0;
+}
+
+int
+reactor_add(int fd, int events, reactor_fn fn, void *ctx) {
+    int r = -1;
+
+    pthread_mutex_lock(&reactor_lock);
+    if (_reserve(fd) == 0) {
+        reactor_entry_s *e = &entries[fd];
+#ifdef REACTOR_EPOLL
+        if (e->used) {
+            r = _ctl(EPOLL_CTL_MOD, fd, events);
+            /* the fd was closed and reused without being removed */
+            if (r && errno == ENOENT) r = _ctl(EPOLL_CTL_ADD, fd, events);
+        } else r = _ctl(EPOLL_CTL_ADD, fd, events);
+#else
+        r = _ctl(0, fd, events);
+#endif
+        if (r == 0) {
+            if (e->suspended) -- suspended_count;
+            e->used      = 1;
+            e->events    = events;
+            e->suspended = 0;
+            e->fn        = fn;
+            e->ctx       = ctx;
+        }
+    }
+    pthread_mutex_unlock(&reactor_lock);
+    return r;
+}
+
+void *
+reactor_del(int fd) {
+    void *ctx = NULL;
+
+    pthread_mutex_lock(&reactor_lock);
+    if (fd >= 0 && fd < entry_alloc && entries[fd].used) {
+        reactor_entry_s *e = &entries[fd];
+#ifdef REACTOR_EPOLL
+        /* a suspended fd is already out of the set */
+        if (!e->suspended) _ctl(EPOLL_CTL_DEL, fd, 0);
+#else
+        _ctl(0, fd, 0);
+#endif
+        if (e->suspended) -- suspended_count;
+        ctx = e->ctx;
+        memset(e, 0, sizeof(reactor_entry_s));
+    }
+    pthread_mutex_unlock(&reactor_lock);
+    return ctx;
+}
+
+int
+reactor_get(int fd, reactor_fn *fn, void **ctx) {
+    int r = -1;
+
+    pthread_mutex_lock(&reactor_lock);
+    if (fd >= 0 && fd < entry_alloc && entries[fd].used) {
+        *fn  = entries[fd].fn;
+        *ctx = entries[fd].ctx;
+        r = 0;
+    }
+    pthread_mutex_unlock(&reactor_lock);
+    return r;
+}
+
+void
+reactor_suspend(int fd) {
+    pthread_mutex_lock(&reactor_lock);
+    if (fd >= 0 && fd < entry_alloc &&
+        entries[fd].used && !entries[fd].suspended) {
+#ifdef REACTOR_EPOLL
+        /* removed, as hangups and errors are reported even with no
+         * events asked for */
+        _ctl(EPOLL_CTL_DEL, fd, 0);
+#else
+        _ctl(0, fd, 0);
+#endif
+        entries[fd].suspended = 1;
+        ++ suspended_count;
+    }
+    pthread_mutex_unlock(&reactor_lock);
+}
+
+void
+reactor_resume_all(void) {
+    int fd;
+
+    pthread_mutex_lock(&reactor_lock);
+    for (fd = 0; suspended_count > 0 && fd < entry_alloc; ++ fd) {
+        if (!entries[fd].suspended) continue;
+#ifdef REACTOR_EPOLL
+        _ctl(EPOLL_CTL_ADD, fd, entries[fd].events);
+#else
+        _ctl(0, fd, entries[fd].events);
+#endif
+        entries[fd].suspended = 0;
+        -- suspended_count;
+    }
+    pthread_mutex_unlock(&reactor_lock);
+}
+
+/* call back a ready fd, it may have been removed by the callback of
+ * another fd of the same batch */
+static void
+_dispatch(int fd, int events, int error) {
+    pthread_mutex_lock(&reactor_lock);
+    if (fd < entry_alloc && entries[fd].used && !entries[fd].suspended) {
+        /* errors and hangups are reported to whatever is watched */
+        if (error) events |= entries[fd].events;
+        events &= entries[fd].events;
+        if (events) entries[fd].fn(fd, events, entries[fd].ctx);
+    }
+    pthread_mutex_unlock(&reactor_lock);
+}
+
+int
+reactor_wait(int timeout_ms) {
+#ifdef REACTOR_EPOLL
+    struct epoll_event ev[REACTOR_BATCH];
+    int i, n;
+
+    n = epoll_wait(epfd, ev, REACTOR_BATCH, timeout_ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+
+    for (i = 0; i < n; ++ i) {
+        int events = 0;
+        if (ev[i].events & EPOLLIN)  events |= REACTOR_READ;
+        if (ev[i].events & EPOLLOUT) events |= REACTOR_WRITE;
+        if (ev[i].events & EPOLLPRI) events |= REACTOR_STATUS;
+        _dispatch(ev[i].data.fd, events, ev[i].events & (EPOLLERR | EPOLLHUP));
+    }
+    return n;
+#else
+    int i, n, count = 0;
+
+    pthread_mutex_lock(&reactor_lock);
+    if (pfd_dirty) {
+        int fd;
+        for (fd = 0; fd < entry_alloc; ++ fd)
+            if (entries[fd].used) ++ count;
+        if (count > pfd_alloc) {
+            struct pollfd *p = (struct pollfd *)realloc(pfds, sizeof(struct pollfd) * count);
+            if (!p) {
+                pthread_mutex_unlock(&reactor_lock);
+                return -1;
+            }
+            pfds = p;
+            pfd_alloc = count;
+        }
+        for (fd = 0, count = 0; fd < entry_alloc; ++ fd) {
+            if (!entries[fd].used) continue;
+            pfds[count].fd = fd;
+            pfds[count].events = 0;
+            pfds[count].revents = 0;
+            if (!entries[fd].suspended) {
+                if (entries[fd].events & REACTOR_READ)   pfds[count].events |= POLLIN;
+                if (entries[fd].events & REACTOR_WRITE)  pfds[count].events |= POLLOUT;
+                if (entries[fd].events & REACTOR_STATUS) pfds[count].events |= POLLPRI;
+            } else pfds[count].fd = -1;
+            ++ count;
+        }
+        /* poll() ignores the unused tail */
+        pfd_dirty = 0;
+        for (i = count; i < pfd_alloc; ++ i) pfds[i].fd = -1;
+    }
+    count = pfd_alloc;
+    pthread_mutex_unlock(&reactor_lock);
+
+    n = poll(pfds, count, timeout_ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+
+    for (i = 0; i < count; ++ i) {
+        int events = 0;
+        if (pfds[i].fd < 0 || !pfds[i].revents) continue;
+        if (pfds[i].revents & POLLIN)  events |= REACTOR_READ;
+        if (pfds[i].revents & POLLOUT) events |= REACTOR_WRITE;
+        if (pfds[i].revents & POLLPRI) events |= REACTOR_STATUS;
+        _dispatch(pfds[i].fd, events, pfds[i].revents & (POLLERR | POLLHUP));
+    }
+    return n;
+#endif
+}
@@ -0,0 +1,33 @@
+#ifndef __DLAUNCHER_REACTOR_H__
+#define __DLAUNCHER_REACTOR_H__
+
+/* fd event reactor
+ *
+ * Registrations persist until removed, and waiting costs in the number
+ * of ready fds. It is backed by epoll on linux and by poll() elsewhere.
+ * Registrations may be changed from any thread, callbacks are called
+ * by the thread running reactor_wait().
+ */
+
+/* same values as DL_FD_EVENT_* */
+#define REACTOR_READ   1
+#define REACTOR_WRITE  2
+#define REACTOR_STATUS 4
+
+typedef void (*reactor_fn)(int fd, int events, void *ctx);
+
+int   reactor_init(void);
+/* watch [fd], replacing any previous registration of it */
+int   reactor_add(int fd, int events, reactor_fn fn, void *ctx);
+/* stop watching [fd], return its ctx */
+void *reactor_del(int fd);
+/* if [fd] is watched, give its callback and ctx and return 0, else -1 */
+int   reactor_get(int fd, reactor_fn *fn, void **ctx);
+/* stop watching [fd] until reactor_resume_all() */
+void  reactor_suspend(int fd);
+void  reactor_resume_all(void);
+/* wait for at most [timeout_ms] (-1 for ever) and call the callbacks
+ * of the ready fds, return the number of them or -1 */
+int   reactor_wait(int timeout_ms);
+
+#endif
@@ -0,0 +1,29 @@
+#include "stats.h"
+
+#include <time.h>
+
+double
+stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void
+stats_add(stats_latency_t s, double ms) {
+    if (s->count == 0 || ms < s->min) s->min = ms;
+    if (s->count == 0 || ms > s->max) s->max = ms;
+    s->last   = ms;
+    s->total += ms;
+    ++ s->count;
+}
+
+void
+stats_print(FILE *out, stats_latency_t s) {
+    if (s->count == 0) {
+        fprintf(out, "%s: no sample\n", s->name);
+        return;
+    }
+    fprintf(out, "%s: count %lu last %.3f min %.3f avg %.3f max %.3f ms\n",
+            s->name, s->count, s->last, s->min, s->total / s->count, s->max);
+}
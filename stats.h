@@ -0,0 +1,22 @@
+#ifndef __DLAUNCHER_STATS_H__
+#define __DLAUNCHER_STATS_H__
+
+#include <stdio.h>
+
+/* latency measurements, in milliseconds */
+typedef struct stats_latency_s *stats_latency_t;
+typedef struct stats_latency_s {
+    const char   *name;
+    unsigned long count;
+    double        last;
+    double        min;
+    double        max;
+    double        total;
+} stats_latency_s;
+
+/* monotonic clock in milliseconds, async-signal-safe */
+double stats_now(void);
+void   stats_add(stats_latency_t s, double ms);
+void   stats_print(FILE *out, stats_latency_t s);
+
+#endif
@@ -0,0 +1,38 @@
+#!/bin/sh
+# usage: hist_newline.sh dlauncher.bin
+#
+# A PROTO=2 plugin answers with a 'B' item whose text has a newline.
+# Opening it must not put a broken record into the history journal, and
+# a journal holding one, from an earlier version, must still load.
+
+bin=$1
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/plugin.sh" <<'PLUGIN'
+while read -r line; do
+    case "$line" in
+    q*) printf 'B\000\000\000\001\000\000\000\000\000\000\000\001\000\000\000\000\000\000\000\007foo\nbar';;
+    esac
+done
+PLUGIN
+
+# the rest of a line cut by a newline, and one looking like a time record
+printf 'ext:old\nrest of line\n@bar\n' > "$dir/history"
+
+run() {
+    printf 'type zqzq\nwait\nkey Return\n' |
+        HOME=$dir PATH=/usr/bin:/bin "$bin" -headless -history "$dir/history" \
+            -pl "ext:sh $dir/plugin.sh:TYPE=EXEC:PROTO=2:HIST=1:PRIORITY=1000"
+}
+
+for i in 1 2; do
+    out=$(run) || { echo "run $i failed"; exit 1; }
+    [ "$out" = "$(printf 'open ext:foo\nbar')" ] || { echo "run $i opened: $out"; exit 1; }
+done
+
+if grep -qx 'bar' "$dir/history"; then
+    echo "newline written to the history"
+    exit 1
+fi
+exit 0
@@ -0,0 +1,157 @@
+#include "trigram.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned int
+_fold(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static unsigned int
+_key(const char *s) {
+    return (_fold(s[0]) << 16) | (_fold(s[1]) << 8) | _fold(s[2]);
+}
+
+static unsigned int
+_hash(unsigned int key) {
+    key *= 0x9e3779b1u;
+    return key ^ (key >> 15);
+}
+
+static tg_list_s *
+_lookup(tg_index_t ix, unsigned int key) {
+    unsigned int mask = ix->slot_alloc - 1;
+    unsigned int i;
+
+    if (!ix->slot) return NULL;
+    for (i = _hash(key) & mask; ix->slot[i].key; i = (i + 1) & mask)
+        if (ix->slot[i].key == key) return &ix->slot[i];
+    return NULL;
+}
+
+static int
+_grow(tg_index_t ix) {
+    unsigned int alloc = ix->slot_alloc ? ix->slot_alloc << 1 : 1024;
+    tg_list_s *slot = (tg_list_s *)calloc(alloc, sizeof(tg_list_s));
+    unsigned int i, j;
+
+    if (!slot) return -1;
+    for (i = 0; i < ix->slot_alloc; ++ i) {
+        if (!ix->slot[i].key) continue;
+        for (j = _hash(ix->slot[i].key) & (alloc - 1); slot[j].key; j = (j + 1) & (alloc - 1));
+        slot[j] = ix->slot[i];
+    }
+    free(ix->slot);
+    ix->slot = slot;
+    ix->slot_alloc = alloc;
+    return 0;
+}
+
+static tg_list_s *
+_insert(tg_index_t ix, unsigned int key) {
+    tg_list_s *l = _lookup(ix, key);
+    unsigned int i;
+
+    if (l) return l;
+    if ((ix->slot_used + 1) * 4 > ix->slot_alloc * 3 && _grow(ix)) return NULL;
+    for (i = _hash(key) & (ix->slot_alloc - 1); ix->slot[i].key; i = (i + 1) & (ix->slot_alloc - 1));
+    ix->slot[i].key = key;
+    ++ ix->slot_used;
+    return &ix->slot[i];
+}
+
+void
+tg_init(tg_index_t ix) {
+    memset(ix, 0, sizeof(tg_index_s));
+}
+
+void
+tg_clear(tg_index_t ix) {
+    unsigned int i;
+    for (i = 0; i < ix->slot_alloc; ++ i)
+        free(ix->slot[i].ids);
+    free(ix->slot);
+    ix->slot = NULL;
+    ix->slot_alloc = ix->slot_used = 0;
+    ix->id_count = 0;
+}
+
+void
+tg_free(tg_index_t ix) {
+    tg_clear(ix);
+    free(ix->result);
+    tg_init(ix);
+}
+
+int
+tg_add(tg_index_t ix, unsigned int id, const char *s) {
+    size_t len = strlen(s), i;
+
+    ++ ix->id_count;
+    for (i = 0; i + TG_MIN_PATTERN <= len; ++ i) {
+        unsigned int key = _key(s + i);
+        tg_list_s *l = _insert(ix, key);
+        if (!l) return -1;
+        /* the same trigram appears earlier in this string */
+        if (l->count > 0 && l->ids[l->count - 1] == id) continue;
+        if (l->count == l->alloc) {
+            unsigned int alloc = l->alloc ? l->alloc << 1 : 4;
+            unsigned int *ids = (unsigned int *)realloc(l->ids, sizeof(unsigned int) * alloc);
+            if (!ids) return -1;
+            l->ids = ids;
+            l->alloc = alloc;
+        }
+        l->ids[l->count ++] = id;
+    }
+    return 0;
+}
+
+int
+tg_query(tg_index_t ix, const char *pattern,
+         const unsigned int **ids, unsigned int *count) {
+    size_t len = strlen(pattern), i;
+    tg_list_s *shortest = NULL;
+
+    *ids = NULL;
+    *count = 0;
+    if (len < TG_MIN_PATTERN) return -1;
+
+    for (i = 0; i + TG_MIN_PATTERN <= len; ++ i) {
+        tg_list_s *l = _lookup(ix, _key(pattern + i));
+        if (!l) return 0;
+        if (!shortest || l->count < shortest->count) shortest = l;
+    }
+
+    if (ix->result_alloc < shortest->count) {
+        unsigned int *r = (unsigned int *)realloc(ix->result, sizeof(unsigned int) * shortest->count);
+        if (!r) return -1;
+        ix->result = r;
+        ix->result_alloc = shortest->count;
+    }
+    memcpy(ix->result, shortest->ids, sizeof(unsigned int) * shortest->count);
+    unsigned int n = shortest->count;
+
+    /* intersect the other lists with the result, probing by binary
+     * search since the result is usually much shorter */
+    for (i = 0; n > 0 && i + TG_MIN_PATTERN <= len; ++ i) {
+        tg_list_s *l = _lookup(ix, _key(pattern + i));
+        unsigned int j, k = 0, lo = 0;
+        if (l == shortest) continue;
+        for (j = 0; j < n; ++ j) {
+            unsigned int hi = l->count;
+            while (lo < hi) {
+                unsigned int mid = (lo + hi) / 2;
+                if (l->ids[mid] < ix->result[j]) lo = mid + 1;
+                else hi = mid;
+            }
+            if (lo == l->count) break;
+            if (l->ids[lo] == ix->result[j]) ix->result[k ++] = ix->result[j];
+        }
+        n = k;
+    }
+
+    *ids = ix->result;
+    *count = n;
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef __DLAUNCHER_TRIGRAM_H__
+#define __DLAUNCHER_TRIGRAM_H__
+
+#if __cplusplus
+extern "C" {
+#endif
+
+    /* trigram index
+     *
+     * Maps every trigram (ASCII letters folded to lower case) to the
+     * sorted list of ids of the strings containing it. A query
+     * intersects the lists of the trigrams of the pattern, starting from
+     * the shortest one, which gives a superset of the strings containing
+     * the pattern; callers verify the candidates. Ids must be added in
+     * increasing order, removal is left to the caller (by ignoring dead
+     * ids and rebuilding from time to time).
+     */
+
+    typedef struct tg_list_s {
+        unsigned int  key;      /* trigram, 0 for an empty slot */
+        unsigned int *ids;
+        unsigned int  count;
+        unsigned int  alloc;
+    } tg_list_s;
+
+    typedef struct tg_index_s *tg_index_t;
+    typedef struct tg_index_s {
+        tg_list_s    *slot;     /* open addressing hash table */
+        unsigned int  slot_alloc;
+        unsigned int  slot_used;
+        unsigned int  id_count; /* ids added since last clear */
+
+        unsigned int *result;
+        unsigned int  result_alloc;
+    } tg_index_s;
+
+    #define TG_MIN_PATTERN 3
+
+    void tg_init(tg_index_t ix);
+    void tg_clear(tg_index_t ix);
+    void tg_free(tg_index_t ix);
+    int  tg_add(tg_index_t ix, unsigned int id, const char *s);
+    /* return -1 if the pattern is shorter than TG_MIN_PATTERN, the
+     * result is sorted and valid until the next call */
+    int  tg_query(tg_index_t ix, const char *pattern,
+                  const unsigned int **ids, unsigned int *count);
+
+#if __cplusplus
+}
+#endif
+
+#endif